@@ -0,0 +1,147 @@
+#include "allocator.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+void SpaceAllocator::insert_free(int offset, int size) {
+	_by_offset[offset] = size;
+	_by_size.insert({size, offset});
+	_free_bytes += size;
+}
+
+void SpaceAllocator::erase_free(std::map<int, int>::iterator it) {
+	_by_size.erase({it->second, it->first});
+	_free_bytes -= it->second;
+	_by_offset.erase(it);
+}
+
+void SpaceAllocator::reset(int begin, int end) {
+	_by_offset.clear();
+	_by_size.clear();
+	_free_bytes = 0;
+	if (end > begin) {
+		insert_free(begin, end - begin);
+	}
+}
+
+void SpaceAllocator::reserve(int offset, int size) {
+	if (size <= 0) return;
+
+	// the free extent holding the range is the last one starting at or before offset
+	auto it = _by_offset.upper_bound(offset);
+	if (it == _by_offset.begin())
+		throw std::runtime_error("Metadata refers to space that is already in use");
+	--it;
+
+	const int free_begin = it->first;
+	const int free_end = it->first + it->second;
+	if (offset + size > free_end)
+		throw std::runtime_error("Metadata refers to space that is already in use");
+
+	erase_free(it);
+	if (offset > free_begin) {
+		insert_free(free_begin, offset - free_begin);
+	}
+	if (offset + size < free_end) {
+		insert_free(offset + size, free_end - offset - size);
+	}
+}
+
+int SpaceAllocator::allocate(int size) {
+	if (size <= 0) return -1;
+
+	std::map<int, int>::iterator it = _by_offset.end();
+	if (_policy == Policy::BEST_FIT) {
+		const auto fit = _by_size.lower_bound({size, 0});
+		if (fit != _by_size.end()) {
+			it = _by_offset.find(fit->second);
+		}
+	} else {
+		for (it = _by_offset.begin(); it != _by_offset.end() && it->second < size; ++it) {}
+	}
+	if (it == _by_offset.end()) return -1;
+
+	const int offset = it->first;
+	const int remaining = it->second - size;
+	erase_free(it);
+	if (remaining > 0) {
+		insert_free(offset + size, remaining);
+	}
+	return offset;
+}
+
+std::vector<std::pair<int, int>> SpaceAllocator::allocate_scattered(int size) {
+	std::vector<std::pair<int, int>> extents;
+	if (size <= 0 || size > _free_bytes) return extents;
+
+	if (const int offset = allocate(size); offset != -1) {
+		extents.emplace_back(offset, size);
+		return extents;
+	}
+
+	// no single extent is large enough, take the largest ones until the request is covered
+	while (size > 0) {
+		const auto [largest, offset] = *_by_size.rbegin();
+		const int taken = std::min(largest, size);
+		reserve(offset, taken);
+		extents.emplace_back(offset, taken);
+		size -= taken;
+	}
+	return extents;
+}
+
+void SpaceAllocator::release(int offset, int size) {
+	if (size <= 0) return;
+
+	// merge with the free extent that ends right where this one begins
+	auto next = _by_offset.lower_bound(offset);
+	if (next != _by_offset.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			erase_free(prev);
+		}
+	}
+
+	// and with the free extent that begins right where this one ends
+	next = _by_offset.find(offset + size);
+	if (next != _by_offset.end()) {
+		size += next->second;
+		erase_free(next);
+	}
+
+	insert_free(offset, size);
+}
+
+void SpaceAllocator::release_all(std::vector<std::pair<int, int>> extents) {
+	std::sort(extents.begin(), extents.end());
+
+	size_t i = 0;
+	while (i < extents.size()) {
+		const int offset = extents[i].first;
+		int end = offset + extents[i].second;
+		for (++i; i < extents.size() && extents[i].first == end; ++i) {
+			end += extents[i].second;
+		}
+		release(offset, end - offset);
+	}
+}
+
+bool SpaceAllocator::extend(int offset, int size, int extra) {
+	if (extra <= 0) return true;
+
+	const auto next = _by_offset.find(offset + size);
+	if (next == _by_offset.end() || next->second < extra) return false;
+
+	const int remaining = next->second - extra;
+	erase_free(next);
+	if (remaining > 0) {
+		insert_free(offset + size + extra, remaining);
+	}
+	return true;
+}
+
+int SpaceAllocator::largest_free() const {
+	return _by_size.empty() ? 0 : _by_size.rbegin()->first;
+}
@@ -0,0 +1,105 @@
+#ifndef ALLOCATOR_H_
+#define ALLOCATOR_H_
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+/**
+ * SpaceAllocator tracks the free byte ranges of the block device.
+ *
+ * Free extents are kept twice: ordered by offset, so a released range can be merged with its
+ * neighbours, and ordered by size, so a best-fit lookup is a single lower_bound.
+ */
+class SpaceAllocator {
+public:
+	enum class Policy {
+		BEST_FIT,  // smallest free extent that is large enough
+		FIRST_FIT  // lowest free extent that is large enough
+	};
+
+	/**
+	 * @brief Forgets every allocation and marks [begin, end) as free.
+	 */
+	void reset(int begin, int end);
+
+	/**
+	 * @brief Marks a range as used. Used when rebuilding the allocator from the metadata.
+	 *
+	 * @throws std::runtime_error If any byte in the range is not free.
+	 */
+	void reserve(int offset, int size);
+
+	/**
+	 * @brief Allocates size contiguous bytes according to the current policy.
+	 *
+	 * @return The offset of the allocated range, or -1 if no free extent is large enough.
+	 */
+	int allocate(int size);
+
+	/**
+	 * @brief Allocates size bytes, split over several extents when no single one is large enough.
+	 *
+	 * @return The allocated (offset, size) extents, or an empty vector if there is not enough free
+	 *         space in total. Nothing is allocated in that case.
+	 */
+	std::vector<std::pair<int, int>> allocate_scattered(int size);
+
+	/**
+	 * @brief Returns a range to the free space, merging it with adjacent free extents.
+	 */
+	void release(int offset, int size);
+
+	/**
+	 * @brief Returns many ranges at once.
+	 *
+	 * The ranges are sorted and adjacent ones are joined first, so each run of freed space costs a
+	 * single merge into the free extents no matter how many ranges it was made of.
+	 */
+	void release_all(std::vector<std::pair<int, int>> extents);
+
+	/**
+	 * @brief Grows an allocated range in place when the bytes right after it are free.
+	 *
+	 * @param offset The first byte of the allocated range.
+	 * @param size The current size of the range.
+	 * @param extra The number of bytes to add at its end.
+	 *
+	 * @return true if the range was grown, false if nothing was changed.
+	 */
+	bool extend(int offset, int size, int extra);
+
+	void set_policy(Policy policy) {
+		_policy = policy;
+	}
+
+	[[nodiscard]] int free_bytes() const {
+		return _free_bytes;
+	}
+
+	/**
+	 * @return The lowest free extent starting at or after offset as an (offset, size) pair,
+	 *         or (-1, 0) when there is none.
+	 */
+	[[nodiscard]] std::pair<int, int> next_free(int offset) const {
+		const auto it = _by_offset.lower_bound(offset);
+		if (it == _by_offset.end()) return {-1, 0};
+		return *it;
+	}
+
+	/**
+	 * @return The size of the largest free extent, 0 when the device is full.
+	 */
+	[[nodiscard]] int largest_free() const;
+
+private:
+	void insert_free(int offset, int size);
+	void erase_free(std::map<int, int>::iterator it);
+
+	std::map<int, int> _by_offset;          // offset -> size
+	std::set<std::pair<int, int>> _by_size; // (size, offset)
+	int _free_bytes = 0;
+	Policy _policy = Policy::BEST_FIT;
+};
+
+#endif // ALLOCATOR_H_
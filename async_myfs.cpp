@@ -0,0 +1,152 @@
+#include "async_myfs.h"
+#include "vfs.h"
+
+AsyncMyFs::AsyncMyFs(MyFs &fs, const unsigned workers) : _fs(fs) {
+	for (unsigned i = 0; i < std::max(workers, 1u); ++i) {
+		_workers.emplace_back(&AsyncMyFs::work, this);
+	}
+}
+
+AsyncMyFs::~AsyncMyFs() {
+	{
+		std::lock_guard lock(_mutex);
+		_stopping = true;
+	}
+	_wakeup.notify_all();
+	for (auto & worker : _workers) {
+		worker.join();
+	}
+}
+
+std::string AsyncMyFs::key_of(const std::string &path_str) {
+	std::string key;
+	for (const auto & name : VFS::split_cmd(path_str, '/')) {
+		if (!name.empty()) key += '/' + name;
+	}
+	return key.empty() ? "/" : key;
+}
+
+void AsyncMyFs::schedule(const std::vector<std::string> &paths, std::function<void()> run) {
+	auto task = std::make_shared<Task>();
+	task->run = std::move(run);
+	for (const auto & path : paths) {
+		std::string key = key_of(path);
+		if (std::find(task->keys.begin(), task->keys.end(), key) == task->keys.end()) {
+			task->keys.push_back(std::move(key));
+		}
+	}
+
+	std::lock_guard lock(_mutex);
+	// a path depends on the directories above it, a directory on everything below it. The latest
+	// operation on each of those runs this one once it is done, an earlier one on the same path
+	// runs before that latest one already
+	std::vector<std::shared_ptr<Task>> earlier;
+	const auto after = [&](const std::shared_ptr<Task> & last) {
+		if (std::find(earlier.begin(), earlier.end(), last) == earlier.end()) earlier.push_back(last);
+	};
+	const auto after_path = [&](const std::string & key) {
+		if (const auto last = _last.find(key); last != _last.end()) after(last->second);
+	};
+	for (const auto & key : task->keys) {
+		after_path("/");
+		for (auto slash = key.find('/', 1); slash != std::string::npos; slash = key.find('/', slash + 1)) {
+			after_path(key.substr(0, slash));
+		}
+		after_path(key);
+		const std::string below = key == "/" ? key : key + '/';
+		for (auto last = _last.lower_bound(below);
+		     last != _last.end() && last->first.compare(0, below.size(), below) == 0; ++last) {
+			after(last->second);
+		}
+	}
+	for (const auto & last : earlier) {
+		last->next.push_back(task);
+		++task->waiting;
+	}
+	for (const auto & key : task->keys) {
+		_last[key] = task;
+	}
+	++_pending;
+	if (task->waiting == 0) {
+		_ready.push_back(std::move(task));
+		_wakeup.notify_one();
+	}
+}
+
+void AsyncMyFs::work() {
+	std::unique_lock lock(_mutex);
+	while (true) {
+		// stopping waits for operations still queued behind others, they become ready in turn
+		_wakeup.wait(lock, [this] { return !_ready.empty() || (_stopping && _pending == 0); });
+		if (_ready.empty()) return;
+
+		const std::shared_ptr<Task> task = std::move(_ready.front());
+		_ready.pop_front();
+		lock.unlock();
+		task->run();
+		lock.lock();
+
+		for (const auto & key : task->keys) {
+			if (const auto last = _last.find(key); last != _last.end() && last->second == task) {
+				_last.erase(last);
+			}
+		}
+		for (auto & next : task->next) {
+			if (--next->waiting == 0) _ready.push_back(std::move(next));
+		}
+		--_pending;
+		_wakeup.notify_all();
+	}
+}
+
+std::future<void> AsyncMyFs::async_create_file(const std::string &path_str, const bool directory) {
+	return submit({path_str}, [this, path_str, directory] { _fs.create_file(path_str, directory); });
+}
+
+std::future<std::string> AsyncMyFs::async_get_content(const std::string &path_str) {
+	return submit({path_str}, [this, path_str] { return _fs.get_content(path_str); });
+}
+
+std::future<void> AsyncMyFs::async_set_content(const std::string &path_str, std::string bytes) {
+	return submit({path_str}, [this, path_str, bytes = std::move(bytes)] { _fs.set_content(path_str, bytes); });
+}
+
+std::future<void> AsyncMyFs::async_append(const std::string &path_str, std::string bytes) {
+	return submit({path_str}, [this, path_str, bytes = std::move(bytes)] { _fs.append(path_str, bytes); });
+}
+
+std::future<std::string> AsyncMyFs::async_read_at(const std::string &path_str, const int offset, const int length) {
+	return submit({path_str}, [this, path_str, offset, length] { return _fs.read_at(path_str, offset, length); });
+}
+
+std::future<void> AsyncMyFs::async_write_at(const std::string &path_str, const int offset, std::string bytes) {
+	return submit({path_str}, [this, path_str, offset, bytes = std::move(bytes)] {
+		_fs.write_at(path_str, offset, bytes);
+	});
+}
+
+std::future<void> AsyncMyFs::async_truncate(const std::string &path_str, const int new_size) {
+	return submit({path_str}, [this, path_str, new_size] { _fs.truncate(path_str, new_size); });
+}
+
+std::future<void> AsyncMyFs::async_preallocate(const std::string &path_str, const int size) {
+	return submit({path_str}, [this, path_str, size] { _fs.preallocate(path_str, size); });
+}
+
+std::future<void> AsyncMyFs::async_clone(const std::string &src_path, const std::string &dst_path) {
+	return submit({src_path, dst_path}, [this, src_path, dst_path] { _fs.clone(src_path, dst_path); });
+}
+
+std::future<void> AsyncMyFs::async_rename(const std::string &old_path, const std::string &new_path, const bool replace) {
+	return submit({old_path, new_path}, [this, old_path, new_path, replace] {
+		_fs.rename(old_path, new_path, replace);
+	});
+}
+
+std::future<void> AsyncMyFs::async_remove_file(const std::string &path_str) {
+	return submit({path_str}, [this, path_str] { _fs.remove_file(path_str); });
+}
+
+std::future<void> AsyncMyFs::async_remove_dir(const std::string &path_str) {
+	return submit({path_str}, [this, path_str] { _fs.remove_dir(path_str); });
+}
@@ -0,0 +1,110 @@
+#ifndef ASYNC_MYFS_H_
+#define ASYNC_MYFS_H_
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "myfs.h"
+
+/**
+ * AsyncMyFs runs MyFs operations on a pool of worker threads and hands back futures.
+ *
+ * Operations are ordered per path: one on a path starts only after every operation submitted
+ * earlier on that path, on a directory above it or on a path below it has finished, so a read
+ * submitted after a write sees it, and one submitted after a directory was renamed or removed
+ * sees that. Operations on unrelated paths run in parallel, as far as MyFs lets them. rename()
+ * and clone() are ordered against both of their paths.
+ *
+ * An exception thrown by an operation is stored in its future.
+ */
+class AsyncMyFs {
+public:
+	/**
+	 * @brief Starts the workers.
+	 *
+	 * @param fs The filesystem to run operations on, it must outlive this object.
+	 * @param workers The number of worker threads, at least one.
+	 */
+	explicit AsyncMyFs(MyFs & fs, unsigned workers = std::max(1u, std::thread::hardware_concurrency()));
+
+	/**
+	 * @brief Runs every operation already submitted, then stops the workers.
+	 */
+	~AsyncMyFs();
+
+	AsyncMyFs(const AsyncMyFs &) = delete;
+	AsyncMyFs & operator=(const AsyncMyFs &) = delete;
+
+	/**
+	 * @return The filesystem operations run on.
+	 */
+	MyFs & filesystem() const {
+		return _fs;
+	}
+
+	std::future<void> async_create_file(const std::string & path_str, bool directory);
+	std::future<std::string> async_get_content(const std::string & path_str);
+	std::future<void> async_set_content(const std::string & path_str, std::string bytes);
+	std::future<void> async_append(const std::string & path_str, std::string bytes);
+	std::future<std::string> async_read_at(const std::string & path_str, int offset, int length);
+	std::future<void> async_write_at(const std::string & path_str, int offset, std::string bytes);
+	std::future<void> async_truncate(const std::string & path_str, int new_size);
+	std::future<void> async_preallocate(const std::string & path_str, int size);
+	std::future<void> async_clone(const std::string & src_path, const std::string & dst_path);
+	std::future<void> async_rename(const std::string & old_path, const std::string & new_path, bool replace = false);
+	std::future<void> async_remove_file(const std::string & path_str);
+	std::future<void> async_remove_dir(const std::string & path_str);
+
+	/**
+	 * @brief Runs any callable on the workers, ordered against the given paths.
+	 *
+	 * @return The future of the callable's result.
+	 */
+	template <typename Operation>
+	auto submit(const std::vector<std::string> & paths, Operation operation) -> std::future<decltype(operation())> {
+		auto task = std::make_shared<std::packaged_task<decltype(operation())()>>(std::move(operation));
+		auto result = task->get_future();
+		schedule(paths, [task] { (*task)(); });
+		return result;
+	}
+
+private:
+	struct Task {
+		std::function<void()> run;
+		std::vector<std::string> keys;
+		int waiting = 0;                          // earlier operations on the same paths still to finish
+		std::vector<std::shared_ptr<Task>> next;  // later operations waiting for this one
+	};
+
+	/**
+	 * @brief Queues an operation behind the last one submitted on each of its paths, on each
+	 *        directory above them and on each path below them, or makes it ready if there is none.
+	 */
+	void schedule(const std::vector<std::string> & paths, std::function<void()> run);
+
+	/**
+	 * @return The path with empty components dropped, so that spellings of one path share a key.
+	 */
+	static std::string key_of(const std::string & path_str);
+
+	void work();
+
+	MyFs & _fs;
+	std::mutex _mutex;
+	std::condition_variable _wakeup;
+	std::deque<std::shared_ptr<Task>> _ready;
+	std::map<std::string, std::shared_ptr<Task>> _last; // the latest operation on each path, the
+	                                                    // paths below a directory sort right after it
+	int _pending = 0;                                   // operations not finished yet
+	bool _stopping = false;
+	std::vector<std::thread> _workers; // last, so they start after everything they use is initialized
+};
+
+#endif // ASYNC_MYFS_H_
@@ -99,3 +99,23 @@ void BlockDeviceSimulator::write(int addr, int size, const char *data) {
 	*/
 }
 
+void BlockDeviceSimulator::readv(const std::vector<std::pair<int, int>> &extents, char *ans) {
+	// gather every extent into one contiguous buffer
+	for (const auto &[addr, size] : extents) {
+		memcpy(ans, filemap + addr, size);
+		ans += size;
+	}
+}
+
+void BlockDeviceSimulator::writev(const std::vector<std::pair<int, int>> &extents, const char *data) {
+	// scatter one contiguous buffer over the extents
+	for (const auto &[addr, size] : extents) {
+		memcpy(filemap + addr, data, size);
+		data += size;
+	}
+}
+
+void BlockDeviceSimulator::sync() {
+	if (msync(filemap, DEVICE_SIZE, MS_SYNC) == -1)
+		throw std::runtime_error(std::string("msync failed: ") + strerror(errno));
+}
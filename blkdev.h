@@ -2,6 +2,8 @@
 #define __BLKDEVSIM__H__
 
 #include <string>
+#include <utility>
+#include <vector>
 
 class BlockDeviceSimulator {
 public:
@@ -11,6 +13,13 @@ public:
 	void read(int addr, int size, char *ans);
 	void write(int addr, int size, const char *data);
 
+	// vectored variants: each extent is an (addr, size) pair, the buffer holds them back to back
+	void readv(const std::vector<std::pair<int, int>> &extents, char *ans);
+	void writev(const std::vector<std::pair<int, int>> &extents, const char *data);
+
+	// waits until everything written so far is stored in the file
+	void sync();
+
 	static const int DEVICE_SIZE = 1024 * 1024;
 
 private:
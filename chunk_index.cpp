@@ -0,0 +1,109 @@
+#include "chunk_index.h"
+#include <cstring>
+
+namespace {
+constexpr std::uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+constexpr std::uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr std::uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+constexpr std::uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+constexpr std::uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+std::uint64_t rotl(const std::uint64_t x, const int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+std::uint64_t read64(const char * p) {
+	std::uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+std::uint32_t read32(const char * p) {
+	std::uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+std::uint64_t round(std::uint64_t acc, const std::uint64_t input) {
+	acc += input * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+std::uint64_t merge_round(std::uint64_t acc, const std::uint64_t val) {
+	acc ^= round(0, val);
+	return acc * PRIME1 + PRIME4;
+}
+}
+
+std::uint64_t ChunkIndex::hash(const char *data, const int size) {
+	// XXH64: four independent lanes over 32-byte stripes, which the compiler can keep in registers
+	const char * p = data;
+	const char * const end = data + size;
+	std::uint64_t h;
+
+	if (size >= 32) {
+		std::uint64_t v1 = PRIME1 + PRIME2;
+		std::uint64_t v2 = PRIME2;
+		std::uint64_t v3 = 0;
+		std::uint64_t v4 = -PRIME1;
+		for (; p + 32 <= end; p += 32) {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+		}
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+		h = merge_round(h, v4);
+	} else {
+		h = PRIME5;
+	}
+	h += static_cast<std::uint64_t>(size);
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= round(0, read64(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+	}
+	if (p + 4 <= end) {
+		h ^= static_cast<std::uint64_t>(read32(p)) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		h ^= static_cast<std::uint64_t>(static_cast<unsigned char>(*p)) * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+int ChunkIndex::find(const std::uint64_t hash) const {
+	const auto it = _by_hash.find(hash);
+	return it == _by_hash.end() ? -1 : it->second;
+}
+
+void ChunkIndex::insert(const std::uint64_t hash, const int offset) {
+	if (const auto it = _by_hash.find(hash); it != _by_hash.end()) {
+		_by_offset.erase(it->second);
+	}
+	forget(offset, CHUNK_SIZE);
+	_by_hash[hash] = offset;
+	_by_offset[offset] = hash;
+}
+
+void ChunkIndex::forget(const int offset, const int length) {
+	// a chunk starting up to CHUNK_SIZE - 1 bytes before offset still overlaps the range
+	auto it = _by_offset.lower_bound(offset - CHUNK_SIZE + 1);
+	while (it != _by_offset.end() && it->first < offset + length) {
+		_by_hash.erase(it->second);
+		it = _by_offset.erase(it);
+	}
+}
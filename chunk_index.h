@@ -0,0 +1,51 @@
+#ifndef CHUNK_INDEX_H_
+#define CHUNK_INDEX_H_
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+
+/**
+ * ChunkIndex finds device ranges that already hold a given chunk of data.
+ *
+ * Files are split into CHUNK_SIZE chunks at fixed file offsets and every chunk stored in a
+ * single device range is recorded under its 64-bit hash. A hash only points at a candidate: the
+ * bytes must be compared before the range is shared, since the range may have been overwritten in
+ * place or two chunks may collide.
+ */
+class ChunkIndex {
+public:
+	static constexpr int CHUNK_SIZE = 1024;
+
+	/**
+	 * @return The XXH64 hash of size bytes of data, with seed 0.
+	 */
+	static std::uint64_t hash(const char * data, int size);
+
+	void clear() {
+		_by_hash.clear();
+		_by_offset.clear();
+	}
+
+	/**
+	 * @return The device offset of a chunk with the given hash, or -1 if there is none.
+	 */
+	[[nodiscard]] int find(std::uint64_t hash) const;
+
+	/**
+	 * @brief Records that the chunk with the given hash is stored at offset, replacing any
+	 * previous range recorded for that hash.
+	 */
+	void insert(std::uint64_t hash, int offset);
+
+	/**
+	 * @brief Forgets every chunk overlapping [offset, offset + length), used when the range is
+	 * freed or its content moves.
+	 */
+	void forget(int offset, int length);
+
+private:
+	std::unordered_map<std::uint64_t, int> _by_hash; // hash -> device offset
+	std::map<int, std::uint64_t> _by_offset;         // device offset -> hash
+};
+
+#endif // CHUNK_INDEX_H_
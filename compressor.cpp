@@ -0,0 +1,143 @@
+#include "compressor.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+constexpr int MIN_MATCH = 4;
+constexpr int MAX_DISTANCE = 65535;
+constexpr int HASH_BITS = 12;
+// the last bytes of a block are always literals, so a match never reads past the end
+constexpr int LAST_LITERALS = 5;
+constexpr int MATCH_LIMIT = 12;
+// decompressing copies whole words of this many bytes while there is room for them
+constexpr int WORD = 8;
+constexpr int SHORT_LITERALS = 2 * WORD;
+
+std::uint32_t read32(const char * p) {
+	std::uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+int hash_of(const std::uint32_t sequence) {
+	return static_cast<int>((sequence * 2654435761U) >> (32 - HASH_BITS));
+}
+
+// lengths of 15 and more continue in extra bytes of 255 each, ended by a smaller one
+bool put_length(char * dst, int & out, const int capacity, int length) {
+	for (; length >= 255; length -= 255) {
+		if (out >= capacity) return false;
+		dst[out++] = static_cast<char>(255);
+	}
+	if (out >= capacity) return false;
+	dst[out++] = static_cast<char>(length);
+	return true;
+}
+
+bool get_length(const char * src, int & in, const int size, int & length) {
+	for (unsigned char byte = 255; byte == 255; length += byte) {
+		if (in >= size) return false;
+		byte = static_cast<unsigned char>(src[in++]);
+	}
+	return true;
+}
+
+bool put_sequence(char * dst, int & out, const int capacity, const char * literals, const int literal_count,
+                  const int distance, const int match_length) {
+	if (out >= capacity) return false;
+	const int token = out++;
+	dst[token] = static_cast<char>(std::min(literal_count, 15) << 4);
+	if (literal_count >= 15 && !put_length(dst, out, capacity, literal_count - 15)) return false;
+	if (out + literal_count > capacity) return false;
+	std::memcpy(dst + out, literals, literal_count);
+	out += literal_count;
+	if (match_length == 0) return true; // the block ends with these literals
+
+	if (out + 2 > capacity) return false;
+	dst[out++] = static_cast<char>(distance & 0xff);
+	dst[out++] = static_cast<char>(distance >> 8);
+	dst[token] = static_cast<char>(dst[token] | std::min(match_length - MIN_MATCH, 15));
+	return match_length - MIN_MATCH < 15 || put_length(dst, out, capacity, match_length - MIN_MATCH - 15);
+}
+}
+
+int Compressor::compress(const char *src, const int size, char *dst, const int capacity) {
+	std::vector<int> table(1 << HASH_BITS, -1); // prefix hash -> last position it was seen at
+	int out = 0;
+	int anchor = 0; // the first byte not yet emitted
+	int position = 0;
+
+	while (position < size - MATCH_LIMIT) {
+		const std::uint32_t sequence = read32(src + position);
+		const int hash = hash_of(sequence);
+		const int candidate = table[hash];
+		table[hash] = position;
+		if (candidate < 0 || position - candidate > MAX_DISTANCE || read32(src + candidate) != sequence) {
+			++position;
+			continue;
+		}
+
+		int length = MIN_MATCH;
+		while (position + length < size - LAST_LITERALS && src[candidate + length] == src[position + length]) {
+			++length;
+		}
+		if (!put_sequence(dst, out, capacity, src + anchor, position - anchor, position - candidate, length)) return 0;
+		position += length;
+		anchor = position;
+	}
+	if (!put_sequence(dst, out, capacity, src + anchor, size - anchor, 0, 0)) return 0;
+	return out;
+}
+
+int Compressor::decompress(const char *src, const int size, char *dst, const int capacity) {
+	int in = 0;
+	int out = 0;
+	while (in < size) {
+		const auto token = static_cast<unsigned char>(src[in++]);
+
+		int literal_count = token >> 4;
+		if (literal_count == 15 && !get_length(src, in, size, literal_count)) return -1;
+		if (in + literal_count > size || out + literal_count > capacity) return -1;
+		if (literal_count <= SHORT_LITERALS && in + SHORT_LITERALS <= size && out + SHORT_LITERALS <= capacity) {
+			// a fixed size copy is a couple of moves, the bytes past the literals are overwritten next
+			std::memcpy(dst + out, src + in, SHORT_LITERALS);
+		} else {
+			std::memcpy(dst + out, src + in, literal_count);
+		}
+		in += literal_count;
+		out += literal_count;
+		if (in == size) break; // the last sequence has no match
+
+		if (in + 2 > size) return -1;
+		const int distance = static_cast<unsigned char>(src[in]) | static_cast<unsigned char>(src[in + 1]) << 8;
+		in += 2;
+		int length = (token & 15) + MIN_MATCH;
+		if (length == 15 + MIN_MATCH && !get_length(src, in, size, length)) return -1;
+		if (distance == 0 || distance > out || out + length > capacity) return -1;
+
+		if (distance >= WORD && out + length + WORD <= capacity) {
+			// a word at a time, each word is read before it is written over
+			for (int i = 0; i < length; i += WORD) {
+				std::memcpy(dst + out + i, dst + out - distance + i, WORD);
+			}
+			out += length;
+			continue;
+		}
+		// a match that overlaps the bytes it produces repeats its first distance bytes, which are
+		// copied a period at a time so that no copy overlaps itself
+		if (distance == 1) {
+			std::memset(dst + out, dst[out - 1], length);
+			out += length;
+			continue;
+		}
+		while (length > 0) {
+			const int copied = std::min(length, distance);
+			std::memcpy(dst + out, dst + out - distance, copied);
+			out += copied;
+			length -= copied;
+		}
+	}
+	return out;
+}
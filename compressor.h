@@ -0,0 +1,34 @@
+#ifndef COMPRESSOR_H_
+#define COMPRESSOR_H_
+
+/**
+ * Compressor packs blocks of data with a byte-oriented LZ77 scheme in the style of LZ4.
+ *
+ * A compressed block is a series of sequences, each a token byte holding a literal count and a
+ * match length, the literals themselves, and a 16-bit distance back to the match. Matches are
+ * found through a small hash table of 4-byte prefixes, so compressing is a single pass and
+ * decompressing is plain copying. Blocks are independent of each other.
+ */
+class Compressor {
+public:
+	/**
+	 * @brief Compresses size bytes of src into dst.
+	 *
+	 * @param capacity The room in dst. Passing less than size keeps only blocks that shrink.
+	 *
+	 * @return The compressed size, or 0 if it would not fit in capacity.
+	 */
+	static int compress(const char * src, int size, char * dst, int capacity);
+
+	/**
+	 * @brief Decompresses a block made by compress().
+	 *
+	 * @return The number of bytes written to dst, or -1 if the block is corrupt or does not fit
+	 *         in capacity.
+	 *
+	 * @note Bytes of dst past the returned size, up to capacity, may be overwritten as well.
+	 */
+	static int decompress(const char * src, int size, char * dst, int capacity);
+};
+
+#endif // COMPRESSOR_H_
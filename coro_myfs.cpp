@@ -0,0 +1,59 @@
+#include "coro_myfs.h"
+
+CoroMyFs::CoroMyFs(AsyncMyFs &workers, CoroExecutor &executor) : _workers(workers), _executor(executor) {
+}
+
+CoroMyFs::Operation<void> CoroMyFs::create_file(const std::string &path_str, const bool directory) {
+	MyFs & fs = _workers.filesystem();
+	return {_workers, _executor, {path_str}, [&fs, path_str, directory] { fs.create_file(path_str, directory); }};
+}
+
+CoroMyFs::Operation<std::string> CoroMyFs::get_content(const std::string &path_str) {
+	MyFs & fs = _workers.filesystem();
+	return {_workers, _executor, {path_str}, [&fs, path_str] { return fs.get_content(path_str); }};
+}
+
+CoroMyFs::Operation<void> CoroMyFs::set_content(const std::string &path_str, std::string bytes) {
+	MyFs & fs = _workers.filesystem();
+	return {_workers, _executor, {path_str}, [&fs, path_str, bytes = std::move(bytes)] {
+		fs.set_content(path_str, bytes);
+	}};
+}
+
+CoroMyFs::Operation<void> CoroMyFs::append(const std::string &path_str, std::string bytes) {
+	MyFs & fs = _workers.filesystem();
+	return {_workers, _executor, {path_str}, [&fs, path_str, bytes = std::move(bytes)] {
+		fs.append(path_str, bytes);
+	}};
+}
+
+CoroMyFs::Operation<std::string> CoroMyFs::read_at(const std::string &path_str, const int offset, const int length) {
+	MyFs & fs = _workers.filesystem();
+	return {_workers, _executor, {path_str}, [&fs, path_str, offset, length] {
+		return fs.read_at(path_str, offset, length);
+	}};
+}
+
+CoroMyFs::Operation<void> CoroMyFs::write_at(const std::string &path_str, const int offset, std::string bytes) {
+	MyFs & fs = _workers.filesystem();
+	return {_workers, _executor, {path_str}, [&fs, path_str, offset, bytes = std::move(bytes)] {
+		fs.write_at(path_str, offset, bytes);
+	}};
+}
+
+CoroMyFs::Operation<void> CoroMyFs::truncate(const std::string &path_str, const int new_size) {
+	MyFs & fs = _workers.filesystem();
+	return {_workers, _executor, {path_str}, [&fs, path_str, new_size] { fs.truncate(path_str, new_size); }};
+}
+
+CoroMyFs::Operation<void> CoroMyFs::rename(const std::string &old_path, const std::string &new_path, const bool replace) {
+	MyFs & fs = _workers.filesystem();
+	return {_workers, _executor, {old_path, new_path}, [&fs, old_path, new_path, replace] {
+		fs.rename(old_path, new_path, replace);
+	}};
+}
+
+CoroMyFs::Operation<void> CoroMyFs::remove_file(const std::string &path_str) {
+	MyFs & fs = _workers.filesystem();
+	return {_workers, _executor, {path_str}, [&fs, path_str] { fs.remove_file(path_str); }};
+}
@@ -0,0 +1,110 @@
+#ifndef CORO_MYFS_H_
+#define CORO_MYFS_H_
+#if !defined(__cpp_impl_coroutine)
+#error "coro_myfs.h needs C++20 coroutines, build with MYFS_COROUTINES=ON (CMake) or COROUTINES=1 (make)"
+#endif
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+#include "async_myfs.h"
+
+/**
+ * CoroExecutor resumes coroutines suspended on CoroMyFs operations. An implementation hands the
+ * work to the event loop of the coroutine runtime in use, so coroutines carry on on its threads
+ * rather than on the filesystem's workers.
+ */
+class CoroExecutor {
+public:
+	virtual ~CoroExecutor() = default;
+
+	/**
+	 * @brief Runs work later on a thread of the executor. Called from AsyncMyFs workers.
+	 */
+	virtual void post(std::function<void()> work) = 0;
+};
+
+/**
+ * CoroMyFs offers MyFs operations as awaitables, as in `co_await fs.read_at(path, 0, 10)`.
+ *
+ * The awaiting coroutine is suspended while the operation runs on an AsyncMyFs worker, ordered
+ * against the other operations on its paths, and resumed through the executor once it is done.
+ * No thread waits for an operation, so thousands can be in flight on a handful of workers. An
+ * exception thrown by the operation is rethrown by co_await.
+ */
+class CoroMyFs {
+public:
+	/**
+	 * Operation is the awaitable every method returns. It must be awaited once, by the coroutine
+	 * that called the method.
+	 */
+	template <typename T>
+	class [[nodiscard]] Operation {
+	public:
+		Operation(AsyncMyFs & workers, CoroExecutor & executor, std::vector<std::string> paths,
+		          std::function<T()> run)
+			: _workers(workers), _executor(executor), _paths(std::move(paths)), _run(std::move(run)) {}
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> coroutine) {
+			// the operation lives in the suspended coroutine's frame until it is resumed
+			_workers.submit(_paths, [this, coroutine] {
+				try {
+					if constexpr (std::is_void_v<T>) {
+						_run();
+						_result.emplace();
+					} else {
+						_result.emplace(_run());
+					}
+				} catch (...) {
+					_error = std::current_exception();
+				}
+				_executor.post([coroutine] { coroutine.resume(); });
+			});
+		}
+
+		T await_resume() {
+			if (_error) std::rethrow_exception(_error);
+			if constexpr (!std::is_void_v<T>) return std::move(*_result);
+		}
+
+	private:
+		using Value = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+		AsyncMyFs & _workers;
+		CoroExecutor & _executor;
+		std::vector<std::string> _paths;
+		std::function<T()> _run;
+		std::optional<Value> _result;
+		std::exception_ptr _error;
+	};
+
+	/**
+	 * @param workers The pool operations run on, it must outlive this object.
+	 * @param executor Resumes the coroutines, it must outlive this object.
+	 */
+	CoroMyFs(AsyncMyFs & workers, CoroExecutor & executor);
+
+	Operation<void> create_file(const std::string & path_str, bool directory);
+	Operation<std::string> get_content(const std::string & path_str);
+	Operation<void> set_content(const std::string & path_str, std::string bytes);
+	Operation<void> append(const std::string & path_str, std::string bytes);
+	Operation<std::string> read_at(const std::string & path_str, int offset, int length);
+	Operation<void> write_at(const std::string & path_str, int offset, std::string bytes);
+	Operation<void> truncate(const std::string & path_str, int new_size);
+	Operation<void> rename(const std::string & old_path, const std::string & new_path, bool replace = false);
+	Operation<void> remove_file(const std::string & path_str);
+
+private:
+	AsyncMyFs & _workers;
+	CoroExecutor & _executor;
+};
+
+#endif // CORO_MYFS_H_
@@ -0,0 +1,36 @@
+#include "defragmenter.h"
+#include <algorithm>
+#include "myfs.h"
+
+Defragmenter::Defragmenter(MyFs &fs, const Config config)
+	: _fs(fs), _config(config), _thread(&Defragmenter::run, this) {
+}
+
+Defragmenter::~Defragmenter() {
+	{
+		std::lock_guard lock(_mutex);
+		_stopping = true;
+	}
+	_wakeup.notify_all();
+	_thread.join();
+}
+
+void Defragmenter::run() {
+	const long budget_per_tick = static_cast<long>(_config.bytes_per_second) * _config.interval.count() / 1000;
+
+	std::unique_lock lock(_mutex);
+	while (!_wakeup.wait_for(lock, _config.interval, [this] { return _stopping; })) {
+		lock.unlock();
+
+		// spend this tick's budget in small steps, giving the filesystem back between them
+		long budget = std::max(budget_per_tick, 1L);
+		while (budget > 0) {
+			const int moved = _fs.compact_step(static_cast<int>(std::min<long>(budget, _config.max_move)));
+			if (moved == 0) break; // nothing to move, or a foreground operation is running
+			budget -= moved;
+			std::this_thread::yield();
+		}
+
+		lock.lock();
+	}
+}
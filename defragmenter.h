@@ -0,0 +1,56 @@
+#ifndef DEFRAGMENTER_H_
+#define DEFRAGMENTER_H_
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class MyFs;
+
+/**
+ * Defragmenter closes the gaps left on the block device by edits and removals.
+ *
+ * It runs on its own thread and repeatedly asks the filesystem to move the extents that follow
+ * the lowest gaps down into them (see MyFs::compact_step). Each step is small and bounded, the
+ * metadata is saved once per step, and a step is skipped whenever a foreground operation holds
+ * the filesystem, so foreground edits and removals never wait for compaction.
+ */
+class Defragmenter {
+public:
+	struct Config {
+		// how many bytes may be moved per second
+		int bytes_per_second = 256 * 1024;
+		// the most bytes moved per step, which bounds how long a foreground operation can be delayed
+		int max_move = 16 * 1024;
+		// how often the thread wakes up to spend its budget
+		std::chrono::milliseconds interval{50};
+	};
+
+	/**
+	 * @brief Starts the background thread.
+	 *
+	 * @param fs The filesystem to compact, it must outlive the defragmenter.
+	 * @param config The I/O budget of the defragmenter.
+	 */
+	Defragmenter(MyFs & fs, Config config);
+
+	/**
+	 * @brief Stops the thread and waits for the current move to finish.
+	 */
+	~Defragmenter();
+
+	Defragmenter(const Defragmenter &) = delete;
+	Defragmenter & operator=(const Defragmenter &) = delete;
+
+private:
+	void run();
+
+	MyFs & _fs;
+	const Config _config;
+	std::mutex _mutex;
+	std::condition_variable _wakeup;
+	bool _stopping = false;
+	std::thread _thread; // last, so it starts after everything it uses is initialized
+};
+
+#endif // DEFRAGMENTER_H_
@@ -0,0 +1,73 @@
+#include "epoch_manager.h"
+#include <unordered_map>
+
+namespace {
+	std::atomic<std::uint64_t> next_id{1};
+}
+
+EpochManager::EpochManager() : _id(next_id++) {}
+
+EpochManager::Guard::~Guard() {
+	if (--_slot.depth == 0) {
+		_slot.epoch.store(0, std::memory_order_release);
+	}
+}
+
+EpochManager::Guard EpochManager::pin() {
+	Slot & slot = this->slot();
+	if (slot.depth++ == 0) {
+		slot.epoch.store(_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+		// the pin must be visible before anything shared is read, quiescent() fences on its side
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+	return Guard(slot);
+}
+
+std::uint64_t EpochManager::advance() {
+	return _epoch.fetch_add(1, std::memory_order_acq_rel);
+}
+
+bool EpochManager::quiescent(const std::uint64_t epoch) const {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	std::lock_guard lock(_mutex);
+	for (const auto & slot : _slots) {
+		const std::uint64_t pinned = slot->epoch.load(std::memory_order_acquire);
+		if (pinned != 0 && pinned <= epoch) return false;
+	}
+	return true;
+}
+
+EpochManager::Slot &EpochManager::slot() {
+	// a thread gives its slots back when it exits, a slot outlives its manager if need be
+	struct Lease {
+		std::shared_ptr<Slot> slot;
+		~Lease() {
+			if (slot) slot->taken.store(false, std::memory_order_release);
+		}
+	};
+	thread_local std::unordered_map<std::uint64_t, Lease> leases;
+
+	if (const auto lease = leases.find(_id); lease != leases.end()) {
+		return *lease->second.slot;
+	}
+
+	std::shared_ptr<Slot> taken;
+	{
+		std::lock_guard lock(_mutex);
+		for (const auto & slot : _slots) {
+			bool expected = false;
+			if (slot->taken.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+				taken = slot;
+				break;
+			}
+		}
+		if (!taken) {
+			taken = std::make_shared<Slot>();
+			taken->taken = true;
+			_slots.push_back(taken);
+		}
+	}
+	Lease & lease = leases[_id];
+	lease.slot = std::move(taken);
+	return *lease.slot;
+}
@@ -0,0 +1,75 @@
+#ifndef EPOCH_MANAGER_H_
+#define EPOCH_MANAGER_H_
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * EpochManager tells a writer when nothing it unlinked can still be in use by a reader, without
+ * readers taking a lock.
+ *
+ * A reader pins the current epoch for as long as it looks at shared data. Pinning writes only to a
+ * slot owned by the reading thread, so readers on different cores never touch the same cache
+ * line. A writer that unlinks an object calls advance(), which ends the epoch, and frees the
+ * object once quiescent() says no thread is pinned in that epoch or an earlier one.
+ */
+class EpochManager {
+private:
+	struct Slot;
+
+public:
+	/**
+	 * Guard keeps the thread pinned until it is destroyed. Guards nest.
+	 */
+	class Guard {
+	public:
+		explicit Guard(Slot & slot) : _slot(slot) {}
+		Guard(const Guard &) = delete;
+		Guard & operator=(const Guard &) = delete;
+		~Guard();
+
+	private:
+		Slot & _slot;
+	};
+
+	EpochManager();
+
+	/**
+	 * @brief Pins the calling thread in the current epoch. Everything it reads while the guard lives
+	 *        stays valid.
+	 */
+	[[nodiscard]] Guard pin();
+
+	/**
+	 * @brief Starts a new epoch. Threads pinning from now on see every change made before the call.
+	 *
+	 * @return The epoch that ended, to pass to quiescent().
+	 */
+	std::uint64_t advance();
+
+	/**
+	 * @return true if no thread is pinned in the given epoch or an earlier one.
+	 */
+	[[nodiscard]] bool quiescent(std::uint64_t epoch) const;
+
+private:
+	struct alignas(64) Slot {
+		std::atomic<std::uint64_t> epoch{0}; // the epoch pinned, 0 when the thread is not reading
+		std::atomic<bool> taken{false};      // whether a thread owns the slot
+		int depth = 0;                       // guards alive, only the owner touches it
+	};
+
+	// the calling thread's slot, taken the first time the thread pins
+	Slot & slot();
+
+	// tells slots of different managers apart in each thread's cache
+	const std::uint64_t _id;
+	std::atomic<std::uint64_t> _epoch{1};
+
+	mutable std::mutex _mutex;                 // guards the list of slots
+	std::vector<std::shared_ptr<Slot>> _slots; // shared with the threads that own them
+};
+
+#endif // EPOCH_MANAGER_H_
@@ -0,0 +1,26 @@
+#include "extent_index.h"
+#include <iterator>
+
+void ExtentIndex::insert(int begin, int end, std::uint64_t inode) {
+	_extents[begin] = {end, inode};
+}
+
+void ExtentIndex::erase(int begin) {
+	_extents.erase(begin);
+}
+
+void ExtentIndex::erase_range(const int offset, const int length) {
+	auto it = _extents.upper_bound(offset);
+	if (it != _extents.begin() && std::prev(it)->second.end >= offset) {
+		--it;
+	}
+	while (it != _extents.end() && it->first < offset + length) {
+		it = _extents.erase(it);
+	}
+}
+
+void ExtentIndex::set_end(int begin, int end) {
+	if (const auto it = _extents.find(begin); it != _extents.end()) {
+		it->second.end = end;
+	}
+}
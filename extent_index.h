@@ -0,0 +1,61 @@
+#ifndef EXTENT_INDEX_H_
+#define EXTENT_INDEX_H_
+#include <cstdint>
+#include <map>
+
+/**
+ * ExtentIndex keeps every allocated range of the block device ordered by its offset, together
+ * with the inode that owns it. It answers "what lives at or after this offset" in O(log n) without
+ * walking the json tree, which is what relocating data needs.
+ */
+class ExtentIndex {
+public:
+	struct Extent {
+		int end;             // last byte of the range
+		std::uint64_t inode; // the inode owning the range
+	};
+
+	void clear() {
+		_extents.clear();
+	}
+
+	/**
+	 * @brief Registers the range [begin, end] as owned by inode.
+	 */
+	void insert(int begin, int end, std::uint64_t inode);
+
+	/**
+	 * @brief Removes the range starting at begin. Unknown offsets are ignored.
+	 */
+	void erase(int begin);
+
+	/**
+	 * @brief Removes every range overlapping [offset, offset + length).
+	 */
+	void erase_range(int offset, int length);
+
+	/**
+	 * @brief Changes the last byte of the range starting at begin.
+	 */
+	void set_end(int begin, int end);
+
+	/**
+	 * @return The first range starting at or after offset, or end() if there is none.
+	 */
+	[[nodiscard]] std::map<int, Extent>::const_iterator lower_bound(int offset) const {
+		return _extents.lower_bound(offset);
+	}
+
+	[[nodiscard]] std::map<int, Extent>::const_iterator begin() const {
+		return _extents.begin();
+	}
+
+	[[nodiscard]] std::map<int, Extent>::const_iterator end() const {
+		return _extents.end();
+	}
+
+private:
+	std::map<int, Extent> _extents; // begin -> extent
+};
+
+#endif // EXTENT_INDEX_H_
@@ -0,0 +1,74 @@
+#include "file_streambuf.h"
+#include <algorithm>
+#include "myfs.h"
+
+FileStreamBuf::FileStreamBuf(const MyFs &fs, const std::string &path_str, const std::ios_base::openmode mode,
+                             const std::size_t buffer_size)
+	: _fs(fs), _mode(mode), _buffer(std::max<std::size_t>(buffer_size, 1)),
+	  _fd(fs.open(path_str, (mode & std::ios_base::trunc) != 0)) {
+}
+
+FileStreamBuf::~FileStreamBuf() {
+	try {
+		flush_buffer();
+		_fs.close(_fd);
+	} catch (...) {
+		// the file may have been removed while it was open
+	}
+}
+
+void FileStreamBuf::flush_buffer() {
+	if (pptr() > pbase()) {
+		const std::string_view chunk(pbase(), pptr() - pbase());
+		setp(nullptr, nullptr);
+		_fs.write(_fd, chunk);
+	}
+	if (gptr() < egptr()) {
+		// the device position is past the bytes that were fetched but not consumed
+		_fs.seek(_fd, static_cast<int>(gptr() - egptr()), MyFs::Whence::CURRENT);
+	}
+	setg(nullptr, nullptr, nullptr);
+}
+
+FileStreamBuf::int_type FileStreamBuf::underflow() {
+	if (!(_mode & std::ios_base::in)) return traits_type::eof();
+	if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+	flush_buffer();
+	// the device bytes are copied straight into the buffer
+	const int count = _fs.read(_fd, _buffer.data(), static_cast<int>(_buffer.size()));
+	if (count == 0) return traits_type::eof();
+
+	setg(_buffer.data(), _buffer.data(), _buffer.data() + count);
+	return traits_type::to_int_type(*gptr());
+}
+
+FileStreamBuf::int_type FileStreamBuf::overflow(const int_type ch) {
+	if (!(_mode & std::ios_base::out)) return traits_type::eof();
+
+	flush_buffer();
+	setp(_buffer.data(), _buffer.data() + _buffer.size());
+	if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(ch);
+		pbump(1);
+	}
+	return traits_type::not_eof(ch);
+}
+
+int FileStreamBuf::sync() {
+	flush_buffer();
+	return 0;
+}
+
+FileStreamBuf::pos_type FileStreamBuf::seekoff(const off_type off, const std::ios_base::seekdir dir,
+                                               std::ios_base::openmode) {
+	flush_buffer();
+	const MyFs::Whence whence = dir == std::ios_base::beg ? MyFs::Whence::SET
+	                          : dir == std::ios_base::cur ? MyFs::Whence::CURRENT
+	                          : MyFs::Whence::END;
+	return _fs.seek(_fd, static_cast<int>(off), whence);
+}
+
+FileStreamBuf::pos_type FileStreamBuf::seekpos(const pos_type pos, const std::ios_base::openmode which) {
+	return seekoff(off_type(pos), std::ios_base::beg, which);
+}
@@ -0,0 +1,61 @@
+#ifndef FILE_STREAMBUF_H_
+#define FILE_STREAMBUF_H_
+#include <ios>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+class MyFs;
+
+/**
+ * FileStreamBuf streams a MyFs file through a fixed-size buffer.
+ *
+ * Reads fetch the next buffer's worth of the file from the device and writes go to the device
+ * each time the buffer fills up, so a file of any size is copied in and out with constant memory.
+ * It can back a std::istream or std::ostream, or be used directly through sgetn()/sputn().
+ */
+class FileStreamBuf : public std::streambuf {
+public:
+	static constexpr std::size_t DEFAULT_BUFFER_SIZE = 4096;
+
+	/**
+	 * @brief Opens a file for streaming.
+	 *
+	 * @param fs The filesystem, it must outlive the buffer.
+	 * @param path_str The file path (e.g. "/somefile").
+	 * @param mode std::ios_base::in and/or out; with trunc the file is emptied first.
+	 * @param buffer_size How many bytes are read or written to the device at a time.
+	 *
+	 * @throws std::runtime_error If the path does not refer to a file.
+	 */
+	FileStreamBuf(const MyFs & fs, const std::string & path_str,
+	              std::ios_base::openmode mode = std::ios_base::in,
+	              std::size_t buffer_size = DEFAULT_BUFFER_SIZE);
+
+	/**
+	 * @brief Writes out what is left in the buffer and closes the file. Errors are dropped, call
+	 * pubsync() first to see them.
+	 */
+	~FileStreamBuf() override;
+
+	FileStreamBuf(const FileStreamBuf &) = delete;
+	FileStreamBuf & operator=(const FileStreamBuf &) = delete;
+
+protected:
+	int_type underflow() override;
+	int_type overflow(int_type ch) override;
+	int sync() override;
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+	// writes out the put area and gives back the unread part of the get area
+	void flush_buffer();
+
+	const MyFs & _fs;
+	const std::ios_base::openmode _mode;
+	std::vector<char> _buffer;
+	int _fd;
+};
+
+#endif // FILE_STREAMBUF_H_
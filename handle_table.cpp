@@ -0,0 +1,71 @@
+#include "handle_table.h"
+#include <stdexcept>
+
+int HandleTable::open(const std::uint64_t inode, json *record) {
+	std::lock_guard lock(_mutex);
+	int slot;
+	if (!_free.empty()) {
+		slot = _free.back();
+		_free.pop_back();
+	} else if (_slots.size() < MAX_OPEN_FILES) {
+		slot = static_cast<int>(_slots.size());
+		_slots.emplace_back();
+	} else {
+		throw std::runtime_error("Too many open files");
+	}
+
+	_slots[slot].handle = {inode, record, 0};
+	_slots[slot].open = true;
+	return static_cast<int>(_slots[slot].generation % (INT32_MAX / MAX_OPEN_FILES)) * MAX_OPEN_FILES + slot;
+}
+
+HandleTable::Slot &HandleTable::slot_of(const int fd) {
+	const int slot = fd % MAX_OPEN_FILES;
+	const auto generation = static_cast<std::uint32_t>(fd / MAX_OPEN_FILES);
+	if (fd < 0 || slot >= static_cast<int>(_slots.size()) || !_slots[slot].open ||
+	    _slots[slot].generation % (INT32_MAX / MAX_OPEN_FILES) != generation) {
+		throw std::runtime_error("Bad file descriptor");
+	}
+	return _slots[slot];
+}
+
+HandleTable::Handle HandleTable::get(const int fd) {
+	std::lock_guard lock(_mutex);
+	return slot_of(fd).handle;
+}
+
+void HandleTable::set_position(const int fd, const int position) {
+	std::lock_guard lock(_mutex);
+	slot_of(fd).handle.position = position;
+}
+
+void HandleTable::close(const int fd) {
+	std::lock_guard lock(_mutex);
+	Slot & slot = slot_of(fd);
+	slot.open = false;
+	++slot.generation;
+	_free.push_back(fd % MAX_OPEN_FILES);
+}
+
+void HandleTable::invalidate(const std::uint64_t inode) {
+	std::lock_guard lock(_mutex);
+	for (size_t slot = 0; slot < _slots.size(); ++slot) {
+		if (_slots[slot].open && _slots[slot].handle.inode == inode) {
+			_slots[slot].open = false;
+			++_slots[slot].generation;
+			_free.push_back(static_cast<int>(slot));
+		}
+	}
+}
+
+void HandleTable::invalidate_all() {
+	std::lock_guard lock(_mutex);
+	_free.clear();
+	for (size_t slot = 0; slot < _slots.size(); ++slot) {
+		if (_slots[slot].open) {
+			_slots[slot].open = false;
+			++_slots[slot].generation;
+		}
+		_free.push_back(static_cast<int>(slot));
+	}
+}
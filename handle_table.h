@@ -0,0 +1,82 @@
+#ifndef HANDLE_TABLE_H_
+#define HANDLE_TABLE_H_
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+/**
+ * HandleTable maps small integer file descriptors to open files.
+ *
+ * A descriptor combines a slot of the table with the generation of that slot. Closing a
+ * descriptor, or removing the file behind it, bumps the generation, so a stale descriptor is
+ * detected even after its slot is reused by another open(). Every method is thread-safe.
+ */
+class HandleTable {
+public:
+	static const int MAX_OPEN_FILES = 1024;
+
+	struct Handle {
+		std::uint64_t inode; // the inode number of the open file
+		json * record;       // its inode record, valid for as long as the handle is
+		int position;        // where the next read or write starts
+	};
+
+	/**
+	 * @brief Binds a new descriptor to an inode.
+	 *
+	 * @return The descriptor.
+	 *
+	 * @throws std::runtime_error If MAX_OPEN_FILES descriptors are already open.
+	 */
+	int open(std::uint64_t inode, json * record);
+
+	/**
+	 * @return A copy of the handle of an open descriptor.
+	 *
+	 * @throws std::runtime_error If the descriptor is closed or stale.
+	 */
+	Handle get(int fd);
+
+	/**
+	 * @brief Moves the position of an open descriptor.
+	 *
+	 * @throws std::runtime_error If the descriptor is closed or stale.
+	 */
+	void set_position(int fd, int position);
+
+	/**
+	 * @brief Releases a descriptor.
+	 *
+	 * @throws std::runtime_error If the descriptor is closed or stale.
+	 */
+	void close(int fd);
+
+	/**
+	 * @brief Makes every descriptor of an inode stale, used when the file is removed.
+	 */
+	void invalidate(std::uint64_t inode);
+
+	/**
+	 * @brief Makes every descriptor stale, used when the metadata is replaced.
+	 */
+	void invalidate_all();
+
+private:
+	struct Slot {
+		Handle handle;
+		std::uint32_t generation = 0;
+		bool open = false;
+	};
+
+	// the slot of a descriptor, the table must be locked
+	Slot & slot_of(int fd);
+
+	std::mutex _mutex;
+	std::vector<Slot> _slots;
+	std::vector<int> _free; // closed slots, reused before the table grows
+};
+
+#endif // HANDLE_TABLE_H_
@@ -0,0 +1,17 @@
+#include "lock_table.h"
+
+int LockTable::stripe_of(const std::uintptr_t key) {
+	// Fibonacci hashing spreads both aligned addresses and consecutive numbers over the stripes
+	return static_cast<int>((static_cast<std::uint64_t>(key) * 0x9E3779B97F4A7C15ULL) >> 58);
+}
+
+RwLock &LockTable::of(const std::uintptr_t key) {
+	return _locks[stripe_of(key)];
+}
+
+std::pair<RwLock *, RwLock *> LockTable::of_both(const std::uintptr_t first, const std::uintptr_t second) {
+	const int a = stripe_of(first);
+	const int b = stripe_of(second);
+	if (a == b) return {&_locks[a], nullptr};
+	return a < b ? std::make_pair(&_locks[a], &_locks[b]) : std::make_pair(&_locks[b], &_locks[a]);
+}
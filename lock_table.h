@@ -0,0 +1,37 @@
+#ifndef LOCK_TABLE_H_
+#define LOCK_TABLE_H_
+#include <array>
+#include <cstdint>
+#include <utility>
+#include "rw_lock.h"
+
+/**
+ * LockTable hands out a readers-writer lock per object without storing one in each object.
+ *
+ * Objects are hashed onto a fixed set of STRIPES locks, so two objects may share a lock. That only
+ * costs some parallelism, but it means a thread holding one object's lock must never take
+ * another's directly: locks for several objects are taken through of_both(), which orders them
+ * and folds a shared stripe into one lock.
+ */
+class LockTable {
+public:
+	static constexpr int STRIPES = 64;
+
+	/**
+	 * @return The lock of the object with the given key.
+	 */
+	RwLock & of(std::uintptr_t key);
+
+	/**
+	 * @return The locks of two objects in the order they must be taken, the second one null when
+	 *         both objects map to the same lock.
+	 */
+	std::pair<RwLock *, RwLock *> of_both(std::uintptr_t first, std::uintptr_t second);
+
+private:
+	static int stripe_of(std::uintptr_t key);
+
+	std::array<RwLock, STRIPES> _locks;
+};
+
+#endif // LOCK_TABLE_H_
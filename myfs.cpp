@@ -1,11 +1,35 @@
 #include "myfs.h"
 #include <cstring>
+#include <optional>
 #include <iostream>
 #include <algorithm>
+#include <tuple>
+#include "defragmenter.h"
 #include "vfs.h"
 
 const char *MyFs::MYFS_MAGIC = "MYFS";
 
+// inline content is kept in the json metadata as hex, which is safe for any byte value
+static std::string to_hex(const char *data, const int size) {
+	static const char digits[] = "0123456789abcdef";
+	std::string hex(2 * size, '0');
+	for (int i = 0; i < size; ++i) {
+		const auto byte = static_cast<unsigned char>(data[i]);
+		hex[2 * i] = digits[byte >> 4];
+		hex[2 * i + 1] = digits[byte & 0xf];
+	}
+	return hex;
+}
+
+static void from_hex(const std::string &hex, char *data) {
+	const auto value = [](const char digit) {
+		return digit <= '9' ? digit - '0' : digit - 'a' + 10;
+	};
+	for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+		data[i / 2] = static_cast<char>(value(hex[i]) << 4 | value(hex[i + 1]));
+	}
+}
+
 MyFs::MyFs(BlockDeviceSimulator *blkdevsim_):blkdevsim(blkdevsim_) {
 	myfs_header header{};
 	blkdevsim->read(0, sizeof(header), reinterpret_cast<char *>(&header));
@@ -35,7 +59,25 @@ MyFs::MyFs(BlockDeviceSimulator *blkdevsim_):blkdevsim(blkdevsim_) {
 
 }
 
+MyFs::~MyFs() {
+	// the defragmenter uses the block device, so it has to stop first
+	_defragmenter.reset();
+	delete _version.load();
+	// this was added, because blkdevsim was allocated on the heap
+	delete blkdevsim;
+}
+
+void MyFs::start_defragmenter(const Defragmenter::Config &config) {
+	_defragmenter = std::make_unique<Defragmenter>(*this, config);
+}
+
+void MyFs::stop_defragmenter() {
+	_defragmenter.reset();
+}
+
 void MyFs::format() const {
+	const Mutation mutation(*this);
+	std::lock_guard lock(_lock);
 	// put the header in place
 	myfs_header header{};
 
@@ -58,10 +100,16 @@ void MyFs::format() const {
 
 
 json * MyFs::traverse(json * current, const std::vector<std::string> & tokens) {
+	return const_cast<json *>(traverse(static_cast<const json *>(current), tokens));
+}
+
+const json * MyFs::traverse(const json * current, const std::vector<std::string> & tokens) {
+	// only lookups that never insert, readers run it concurrently
 	for (const auto& token : tokens) {
 		if (token.empty()) continue; // Skip empty tokens (could happen with leading '/')
-		if (current->contains("contents") && (*current)["contents"].contains(token)) {
-			current = &(*current)["contents"][token];
+		const auto contents = current->find("contents");
+		if (contents != current->end() && contents->contains(token)) {
+			current = &contents->at(token);
 		} else {
 			throw std::runtime_error("File or directory not found");
 		}
@@ -78,7 +126,52 @@ json * MyFs::get_parent(json *current, const std::vector<std::string> & tokens)
 	return  traverse(current, path_vector);
 }
 
-void MyFs::build_json(const std::vector<std::string> &tokens, const bool directory, json * from_root, json * current) {
+std::vector<std::string> MyFs::names_of(const std::string &path_str) {
+	std::vector<std::string> names = VFS::split_cmd(path_str, '/');
+	names.erase(std::remove(names.begin(), names.end(), ""), names.end());
+	return names;
+}
+
+json * MyFs::find_entry(json &directory, const std::string &name) {
+	const auto contents = directory.find("contents");
+	if (contents == directory.end()) return nullptr;
+	const auto entry = contents->find(name);
+	return entry == contents->end() ? nullptr : &*entry;
+}
+
+json * MyFs::parent_of(const std::vector<std::string> &names) const {
+	json * current = &_data->at("/");
+	for (size_t i = 0; i + 1 < names.size(); ++i) {
+		// no lock coupling: the directory cannot go away while the tree is held
+		std::shared_lock entries(directory_lock(*current));
+		current = find_entry(*current, names[i]);
+		if (current == nullptr) throw std::runtime_error("File or directory not found");
+	}
+	return current;
+}
+
+template <typename Lock>
+std::uint64_t MyFs::file_of(const std::string &path_str, Lock &inodes) const {
+	const std::vector<std::string> names = names_of(path_str);
+	if (names.empty()) throw std::runtime_error("Path does not refer to a file");
+
+	json * parent = parent_of(names);
+	std::shared_lock entries(directory_lock(*parent));
+	const json * file = find_entry(*parent, names.back());
+	if (file == nullptr) throw std::runtime_error("File or directory not found");
+
+	// Check if the path refers to a file
+	if (file->at("type") != "file") {
+		throw std::runtime_error("Path does not refer to a file");
+	}
+
+	// the table is taken before the directory is let go, so a remove cannot come in between
+	inodes = Lock(_inodes_lock);
+	return file->at("inode");
+}
+
+void MyFs::build_json(const std::vector<std::string> &tokens, const bool directory, json * from_root, json * current,
+                      const std::uint64_t inode) {
 	if (tokens.size() == 1) {
 		if (directory) {
 			(*current)["contents"][tokens[0]] = {
@@ -88,8 +181,7 @@ void MyFs::build_json(const std::vector<std::string> &tokens, const bool directo
 		} else {
 			(*current)["contents"][tokens[0]] = {
 				{"type", "file"},
-				{"begin", -1 },  // Example: Setting file begin offset
-				{"end", -1 }     // Example: Setting file end offset
+				{"inode", inode }  // the file's size and extents live in its inode
 			};
 		}
 	}else {
@@ -101,325 +193,1397 @@ void MyFs::build_json(const std::vector<std::string> &tokens, const bool directo
 		} else {
 			(*from_root)["contents"][tokens.back()] = {
 				{"type", "file"},
-				{"begin", -1 },  // Example: Setting file begin offset
-				{"end", -1 }     // Example: Setting file end offset
+				{"inode", inode }  // the file's size and extents live in its inode
 			};
 		}
 	}
 }
 
 void MyFs::create_file(const std::string& path_str, bool directory) const {
-	// Start from the root directory
-	json* current = &(*_data)["/"];  // Assuming the root directory is named "root"
-	json* from_root = &(*_data)["/"];
+	const Mutation mutation(*this);
+	[&] {
+		std::shared_lock tree(_lock);
+		const std::vector<std::string> names = names_of(path_str);
+		if (names.empty()) throw std::runtime_error("usage command touch <file>");
+
+		// only the parent is locked for writing, creates in other directories go on in parallel
+		json * parent = parent_of(names);
+		std::unique_lock entries(directory_lock(*parent));
+		if ((*parent)["type"] != "directory") {
+			throw std::runtime_error("Path does not refer to a directory");
+		}
 
-	// Split path_str into tokens
-	const std::vector<std::string> tokens = VFS::split_cmd(path_str, '/');
+		if ((*parent)["contents"].contains(names.back())) {
+			if(!directory)
+				throw std::runtime_error("File already exists");
+			throw std::runtime_error("Directory already exists");
+
+		}
+
+		// files and directories created in a compressed directory are compressed as well
+		const bool compressed = parent->value("compressed", false);
+		std::uint64_t number = 0;
+		if (!directory) {
+			std::unique_lock inodes(_inodes_lock);
+			number = new_inode();
+			if (compressed) (*inode(number))["chunks"] = json::array();
+		}
+
+		build_json({names.back()}, directory, parent, parent, number);
+		if (directory && compressed) {
+			(*parent)["contents"][names.back()]["compressed"] = true;
+		}
+		std::vector<std::uint64_t> created;
+		if (!directory) created.push_back(number);
+		changed_entries({{names.begin(), names.end() - 1}}, created);
+	}();
+	save_changes();
+}
 
-	if(tokens.empty()) throw std::runtime_error("usage command touch <file>");
+std::string MyFs::get_content(const std::string& path_str) const {
+	// the version, and every range it refers to, stays while the thread is pinned
+	const auto pin = _epochs.pin();
+	const Version & version = *_version.load(std::memory_order_acquire);
+	const Found found = find_in(version, VFS::split_cmd(path_str, '/'));
 
-	if( tokens.size() != 1) {
-		from_root = get_parent(from_root, tokens);
+	// Check if the path refers to a file
+	if (found.directory != nullptr) {
+		throw std::runtime_error("Path does not refer to a file");
 	}
 
+	const json & inode = inode_in(version, found.inode);
+	std::string content(inode.at("size").get<int>(), '\0');
+	read_inode(inode, 0, static_cast<int>(content.size()), content.data());
+	return content;
+}
+
+void MyFs::append(const std::string &path_str, const std::string_view bytes) const {
+	const Mutation mutation(*this);
+	[&] {
+		std::shared_lock tree(_lock);
+		std::shared_lock<RwLock> inodes;
+		const std::uint64_t number = file_of(path_str, inodes);
+		std::unique_lock file(inode_lock(number));
+		const auto space = space_for_write();
+		changed_inode(number);
+
+		json & inode = *this->inode(number);
+		write_inode_at(number, inode, inode["size"], bytes.data(), static_cast<int>(bytes.size()));
+	}();
+	save_changes();
+}
 
+std::string MyFs::read_at(const std::string &path_str, const int offset, const int length) const {
+	std::string content(std::max(length, 0), '\0');
+	content.resize(read_at(path_str, offset, content.data(), length));
+	return content;
+}
+
+int MyFs::read_at(const std::string &path_str, const int offset, char *buffer, const int length) const {
+	if (offset < 0 || length < 0) throw std::runtime_error("Offset and length must not be negative");
+
+	const auto pin = _epochs.pin();
+	const Version & version = *_version.load(std::memory_order_acquire);
+	const Found found = find_in(version, VFS::split_cmd(path_str, '/'));
+
+	// Check if the path refers to a file
+	if (found.directory != nullptr) {
+		throw std::runtime_error("Path does not refer to a file");
+	}
+
+	// reading past the end of the file returns only the bytes that exist
+	const json & inode = inode_in(version, found.inode);
+	const int size = inode.at("size");
+	const int count = std::max(0, std::min(length, size - offset));
+	read_inode(inode, offset, count, buffer);
+	return count;
+}
+
+void MyFs::write_at(const std::string &path_str, const int offset, const std::string_view bytes) const {
+	const Mutation mutation(*this);
+	if (offset < 0) throw std::runtime_error("Offset must not be negative");
+
+	[&] {
+		std::shared_lock tree(_lock);
+		std::shared_lock<RwLock> inodes;
+		const std::uint64_t number = file_of(path_str, inodes);
+		std::unique_lock file(inode_lock(number));
+		const auto space = space_for_write();
+		changed_inode(number);
+
+		write_inode_at(number, *inode(number), offset, bytes.data(), static_cast<int>(bytes.size()));
+	}();
+	save_changes();
+}
+
+void MyFs::preallocate(const std::string &path_str, const int size) const {
+	const Mutation mutation(*this);
+	[&] {
+		std::shared_lock tree(_lock);
+		std::shared_lock<RwLock> inodes;
+		const std::uint64_t number = file_of(path_str, inodes);
+		std::unique_lock file(inode_lock(number));
+		const auto space = space_for_write();
+		changed_inode(number);
+
+		json & inode = *this->inode(number);
+		// compressed chunks are sized when they are packed, there is no space to reserve ahead
+		if (inode.contains("chunks")) return;
+
+		std::vector<std::pair<int, int>> extents = extents_of(inode);
+		int capacity = 0;
+		for (const auto & extent : extents) {
+			capacity += extent.second;
+		}
+		std::vector<bool> shared;
+		const auto reserved = pieces(extents, 0, std::min(size, capacity), shared);
+		if (size <= capacity && std::find(shared.begin(), shared.end(), true) == shared.end() &&
+		    std::none_of(reserved.begin(), reserved.end(), [](const auto & piece) { return piece.first == HOLE; })) {
+			return;
+		}
+
+		// inline files and slots cannot grow past their storage, they move to extents first
+		if (inode.contains("inline") || in_slot(extents)) {
+			unpack(number, inode, extents);
+			capacity = inode["size"];
+		}
 
-	if ((*from_root)["type"] == "directory" && (*from_root)["contents"].contains(tokens.back())) {
-		if(!directory)
+		// holes and bytes shared with clones get private space, so later writes stay in place
+		own_range(number, extents, 0, std::min(size, capacity), true);
+		inode["extents"] = extents;
+		if (size > capacity) {
+			add_capacity(number, extents, size - capacity);
+		}
+		inode["extents"] = extents;
+	}();
+	save_changes();
+}
+
+void MyFs::truncate(const std::string &path_str, const int new_size) const {
+	const Mutation mutation(*this);
+	if (new_size < 0) throw std::runtime_error("Size must not be negative");
+
+	[&] {
+		std::shared_lock tree(_lock);
+		std::shared_lock<RwLock> inodes;
+		const std::uint64_t number = file_of(path_str, inodes);
+		std::unique_lock file(inode_lock(number));
+		const auto space = space_for_write();
+		changed_inode(number);
+
+		json & inode = *this->inode(number);
+		if (inode.contains("chunks")) {
+			truncate_compressed(inode, new_size);
+			return;
+		}
+
+		const int old_size = inode["size"];
+		std::vector<std::pair<int, int>> extents = extents_of(inode);
+
+		if (inode.contains("inline") && new_size <= _inline_threshold) {
+			// the hex string is cut, or padded with zero bytes
+			std::string hex = inode["inline"];
+			hex.resize(2 * new_size, '0');
+			inode["inline"] = hex;
+			if (new_size == 0) inode.erase("inline");
+			inode["size"] = new_size;
+			return;
+		}
+
+		leave_committed_slot(number, inode, extents);
+		const bool in_slot = this->in_slot(extents);
+		if (in_slot && new_size <= extents.front().second) {
+			// a slot keeps its size class, the bytes past the old end are cleared when they come back
+			clear_range(extents, old_size, new_size - old_size);
+			inode["size"] = new_size;
+			return;
+		}
+		if (inode.contains("inline") || in_slot) {
+			unpack(number, inode, extents);
+		}
+
+		int capacity = 0;
+		for (const auto & extent : extents) {
+			capacity += extent.second;
+		}
+		if (new_size < old_size) {
+			// only the tail is freed, nothing before it is touched
+			release_tail(extents, new_size);
+		} else {
+			// the bytes past the old end read as zeros: the capacity is cleared, the rest is a hole
+			clear_range(extents, old_size, std::min(new_size, capacity) - old_size);
+			if (new_size > capacity) {
+				extents.emplace_back(HOLE, new_size - capacity);
+			}
+		}
+		inode["size"] = new_size;
+		inode["extents"] = extents;
+	}();
+	save_changes();
+}
+
+void MyFs::clone(const std::string &src_path, const std::string &dst_path) const {
+	const Mutation mutation(*this);
+	[&] {
+		std::shared_lock tree(_lock);
+		const std::vector<std::string> src_names = names_of(src_path);
+		const std::vector<std::string> dst_names = names_of(dst_path);
+		if (src_names.empty()) throw std::runtime_error("Path does not refer to a file");
+		json * src_parent = parent_of(src_names);
+		if (dst_names.empty()) throw std::runtime_error("usage command clone <file> <new file>");
+		json * dst_parent = parent_of(dst_names);
+
+		// the lock table orders the two directories, so two clones between them cannot deadlock
+		const auto [first, second] = _dir_locks.of_both(reinterpret_cast<std::uintptr_t>(src_parent),
+		                                                reinterpret_cast<std::uintptr_t>(dst_parent));
+		std::unique_lock first_entries(*first);
+		std::unique_lock<RwLock> second_entries;
+		if (second != nullptr) second_entries = std::unique_lock(*second);
+
+		const json * source = find_entry(*src_parent, src_names.back());
+		if (source == nullptr) throw std::runtime_error("File or directory not found");
+
+		// Check if the path refers to a file
+		if (source->at("type") != "file") {
+			throw std::runtime_error("Path does not refer to a file");
+		}
+
+		if ((*dst_parent)["type"] != "directory") {
+			throw std::runtime_error("Path does not refer to a directory");
+		}
+		if ((*dst_parent)["contents"].contains(dst_names.back())) {
 			throw std::runtime_error("File already exists");
-		throw std::runtime_error("Directory already exists");
+		}
 
+		// adding an inode locks the whole table, no other file's content changes meanwhile
+		std::unique_lock inodes(_inodes_lock);
+		const json & original = *inode_of(*source);
+		const std::uint64_t number = new_inode();
+		json & copy = *inode(number);
+		const std::vector<std::pair<int, int>> extents = extents_of(original);
+		if (in_slot(extents)) {
+			// a slot holds at most a few hundred bytes, the clone gets its own
+			const int size = original["size"];
+			std::vector<char> content(size);
+			read_inode(original, 0, size, content.data());
+			write_inode(number, copy, content.data(), size);
+		} else {
+			// everything else is shared: both files refer to the same ranges until one of them writes
+			copy = original;
+			std::lock_guard space(_space_lock);
+			for (const auto & [offset, length] : extents) {
+				if (offset == HOLE) continue;
+				_refs.share(offset, length);
+				_index.erase(offset);
+			}
+			if (original.contains("chunks")) {
+				for (const auto & chunk : chunks_of(original)) {
+					if (chunk.offset != HOLE) _refs.share(chunk.offset, chunk.stored);
+				}
+			}
+		}
+
+		build_json({dst_names.back()}, false, dst_parent, dst_parent, number);
+		changed_entries({{dst_names.begin(), dst_names.end() - 1}}, {number});
+	}();
+	save_changes();
+}
+
+void MyFs::rename(const std::string &old_path, const std::string &new_path, const bool replace) const {
+	const Mutation mutation(*this);
+	const std::vector<std::string> old_names = names_of(old_path);
+	const std::vector<std::string> new_names = names_of(new_path);
+	if (old_names.empty()) throw std::runtime_error("Cannot move the root directory");
+	if (new_names.empty()) throw std::runtime_error("usage command mv <old path> <new path>");
+
+	// a file moves with only its old and new directory locked
+	bool moves_directory = false;
+	[&] {
+		std::shared_lock tree(_lock);
+		json * old_parent = parent_of(old_names);
+		json * new_parent = parent_of(new_names);
+		const auto [first, second] = _dir_locks.of_both(reinterpret_cast<std::uintptr_t>(old_parent),
+		                                                reinterpret_cast<std::uintptr_t>(new_parent));
+		std::unique_lock first_entries(*first);
+		std::unique_lock<RwLock> second_entries;
+		if (second != nullptr) second_entries = std::unique_lock(*second);
+
+		const json * current = find_entry(*old_parent, old_names.back());
+		if (current == nullptr) throw std::runtime_error("File or directory not found");
+		if (current->at("type") == "directory") {
+			moves_directory = true;
+			return;
+		}
+		relink(*old_parent, old_names, *new_parent, new_names, replace);
+	}();
+	if (!moves_directory) {
+		save_changes();
+		return;
 	}
 
-	// If only the root path is provided, create the file or directory directly
-	build_json(tokens, directory, from_root,current);
+	// a directory moves with the whole tree held: the move changes which directories hold which,
+	// and every other operation counts on directories staying where they were found
+	std::unique_lock tree(_lock);
+	json * root = &(*_data)["/"];
+	json * current = traverse(root, old_names);
+	json * old_parent = get_parent(root, old_names);
+	json * new_parent = get_parent(root, new_names);
+	if ((*new_parent)["type"] != "directory") {
+		throw std::runtime_error("Path does not refer to a directory");
+	}
+	if (current == new_parent || ((*current)["type"] == "directory" && contains(*current, *new_parent))) {
+		throw std::runtime_error("Cannot move a directory into itself");
+	}
+	relink(*old_parent, old_names, *new_parent, new_names, replace);
+	flush();
+}
 
-	VFS::write_json_file();
+void MyFs::relink(json &old_parent, const std::vector<std::string> &old_names, json &new_parent,
+                  const std::vector<std::string> &new_names, const bool replace) const {
+	const std::string & old_name = old_names.back();
+	const std::string & new_name = new_names.back();
+	json & current = old_parent["contents"][old_name];
+	if (new_parent["type"] != "directory") {
+		throw std::runtime_error("Path does not refer to a directory");
+	}
 
+	json & entries = new_parent["contents"];
+	std::vector<std::uint64_t> replaced;
+	std::unique_lock<RwLock> inodes;
+	if (entries.contains(new_name)) {
+		json & existing = entries[new_name];
+		if (&existing == &current) return;
+		if (!replace) throw std::runtime_error("File already exists");
+		if (existing["type"] != "file" || current["type"] != "file") {
+			throw std::runtime_error("Only a file can replace a file");
+		}
+		// the replaced file goes away in the same metadata update that puts the new one in its place
+		inodes = std::unique_lock(_inodes_lock);
+		replaced.push_back(existing.at("inode"));
+		release_inode(existing);
+	}
+
+	// only the directory entry moves, the inode and its data stay where they are
+	json entry = std::move(current);
+	old_parent["contents"].erase(old_name);
+	entries[new_name] = std::move(entry);
+	changed_entries({{old_names.begin(), old_names.end() - 1}, {new_names.begin(), new_names.end() - 1}}, replaced);
 }
 
-std::string MyFs::get_content(const std::string& path_str) const {
-	json* current = &(*_data)["/"];
-	const std::vector<std::string> tokens = VFS::split_cmd(path_str, '/');
+bool MyFs::contains(const json &directory, const json &node) {
+	for (const auto & item : directory.at("contents")) {
+		if (&item == &node || (item["type"] == "directory" && contains(item, node))) return true;
+	}
+	return false;
+}
 
-	current = traverse(current, tokens);
+void MyFs::set_compression(const std::string &path_str, const bool enabled) const {
+	const Mutation mutation(*this);
+	// converting rewrites whole subtrees, nothing else runs meanwhile
+	std::lock_guard lock(_lock);
+	json * current = traverse(&(*_data)["/"], VFS::split_cmd(path_str, '/'));
+	changed_all();
 
-	// Check if the path refers to a file
-	if ((*current)["type"] != "file") {
-		throw std::runtime_error("Path does not refer to a file");
+	try {
+		if ((*current)["type"] == "file") {
+			convert(current->at("inode"), *inode_of(*current), enabled);
+		} else {
+			convert_tree(*current, enabled);
+		}
+	} catch (std::runtime_error &) {
+		// the files converted so far have freed their old storage, the metadata must say so
+		flush();
+		throw;
 	}
+	flush();
+}
 
-	const int begin = (*current)["begin"];
-	const int end = (*current)["end"];
-	if(begin == -1 || end == -1) return ""; // content is empty
+void MyFs::convert_tree(json &directory, const bool compressed) const {
+	if (compressed) {
+		directory["compressed"] = true;
+	} else {
+		directory.erase("compressed");
+	}
+	for (auto & item : directory["contents"]) {
+		if (item["type"] == "file") {
+			convert(item.at("inode"), *inode_of(item), compressed);
+		} else {
+			convert_tree(item, compressed);
+		}
+	}
+}
+
+void MyFs::convert(const std::uint64_t number, json &inode, const bool compressed) const {
+	if (inode.contains("chunks") == compressed) return;
+
+	const int size = inode["size"];
+	std::vector<char> content(size);
+	read_inode(inode, 0, size, content.data());
 
-	const int size = end - begin + 1 ;
-	char * ans = new char[size];
-	ans[size] = '\0';
- 	blkdevsim->read(begin, size,ans);
-	std::string a = ans;
-	delete [] ans;
-	return a;
+	// the new copy is stored before the old one is freed, so a full device leaves the file as it was
+	if (compressed) {
+		const std::vector<Chunk> chunks = store_chunks(content.data(), size);
+		free_extents(extents_of(inode));
+		inode.erase("inline");
+		inode["extents"] = json::array();
+		set_chunks(inode, chunks);
+	} else {
+		const std::vector<Chunk> chunks = chunks_of(inode);
+		inode.erase("chunks");
+		try {
+			write_inode(number, inode, content.data(), size);
+		} catch (std::runtime_error &) {
+			set_chunks(inode, chunks);
+			throw;
+		}
+		free_chunks(chunks);
+	}
 }
 
 void MyFs::set_content(const std::string& path_str) const {
-	// Start from the root directory
-	json * current = &(*_data)["/"];
-	int offsetValue = (*_data)["offset"];
-	const std::vector<std::string> tokens = VFS::split_cmd(path_str, '/');
-
-	// Traverse the path to locate the file
-	current = traverse(current, tokens);
+	{
+		// Check if the path refers to a file before asking for its content
+		std::shared_lock tree(_lock);
+		std::shared_lock<RwLock> inodes;
+		static_cast<void>(file_of(path_str, inodes));
+	}
 
-	std::string content;
+	// the filesystem is not held while waiting for the user: the whole line is read before the
+	// edit counts as a change, so a transaction on another thread does not wait for the typing
 	std::cout << "Enter new file content" <<std::endl;
-	std::getline(std::cin,content);
+	std::string line;
+	std::streambuf * input = std::cin.rdbuf();
+	for (auto ch = input->sbumpc(); ch != std::char_traits<char>::eof() && ch != '\n'; ch = input->sbumpc()) {
+		line.push_back(static_cast<char>(ch));
+	}
 
-	// Check if the path refers to a file
-	if ((*current)["type"] != "file") {
-		throw std::runtime_error("Path does not refer to a file");
+	// the line is staged in an inode no directory refers to, and replaces the file's content only
+	// once all of it is on the device: a full device leaves the file as it was
+	const Mutation mutation(*this);
+	std::uint64_t staged = 0;
+	{
+		std::shared_lock tree(_lock);
+		std::unique_lock<RwLock> inodes;
+		const bool compressed = inode(file_of(path_str, inodes))->contains("chunks");
+		staged = new_inode();
+		(*inode(staged))["staging"] = true; // dropped on mount if the line never made it
+		if (compressed) (*inode(staged))["chunks"] = json::array();
+	}
+	const auto discard = [this, staged] {
+		[&] {
+			std::shared_lock tree(_lock);
+			std::unique_lock inodes(_inodes_lock);
+			// an aborted transaction may have taken it already
+			if (!(*_data)["inodes"].contains(std::to_string(staged))) return;
+			json file = {{"inode", staged}};
+			release_inode(file);
+			changed_inode(staged);
+		}();
+		// the saved metadata lets the staged storage go
+		save_changes();
+	};
+
+	// the metadata is not saved meanwhile, nothing refers to the staging inode yet
+	try {
+		std::shared_lock tree(_lock);
+		std::shared_lock inodes(_inodes_lock);
+		std::unique_lock file(inode_lock(staged));
+		const auto space = space_for_write();
+		write_inode_at(staged, *inode(staged), 0, line.data(), static_cast<int>(line.size()));
+	} catch (std::runtime_error &) {
+		discard();
+		throw;
 	}
 
-	int begin = (*current)["begin"];
-	int end = (*current)["end"];
-	int current_size = end-begin+1;
+	// one metadata update swaps the staged content in and frees the old one
+	try {
+		[&] {
+			std::shared_lock tree(_lock);
+			std::unique_lock<RwLock> inodes;
+			const std::uint64_t number = file_of(path_str, inodes);
+			json & record = *inode(number);
+			free_extents(extents_of(record));
+			if (record.contains("chunks")) free_chunks(chunks_of(record));
+
+			// the record is replaced in place, open handles keep pointing at it
+			record = std::move(*inode(staged));
+			record.erase("staging");
+			(*_data)["inodes"].erase(std::to_string(staged));
+			std::lock_guard space(_space_lock);
+			for (const auto & [offset, size] : extents_of(record)) {
+				const auto indexed = _index.lower_bound(offset);
+				if (offset != HOLE && indexed != _index.end() && indexed->first == offset) {
+					_index.insert(offset, offset + size - 1, number);
+				}
+			}
+			changed_inode(number);
+			changed_inode(staged);
+		}();
+	} catch (std::runtime_error &) {
+		// the file went away while the line was read
+		discard();
+		throw;
+	}
+	save_changes();
+}
 
-	// Allocate buffer and copy content
-	char* buffer = new char[content.size()+1];
-	buffer[content.size()] = '\0';
+void MyFs::set_content(const std::string &path_str, const std::string_view bytes) const {
+	const Mutation mutation(*this);
+	[&] {
+		std::shared_lock tree(_lock);
+		std::shared_lock<RwLock> inodes;
+		const std::uint64_t number = file_of(path_str, inodes);
+		std::unique_lock file(inode_lock(number));
+		const auto space = space_for_write();
+		changed_inode(number);
+
+		write_inode(number, *inode(number), bytes.data(), static_cast<int>(bytes.size()));
+	}();
+	save_changes();
+}
 
-	std::strncpy(buffer, content.c_str(), content.size());
 
-	if ( (begin == -1 || end == -1) ) {
 
-		// if the beginning or the end is equal to -1, this file has 0 charchters
-		blkdevsim->write(offsetValue + 1,static_cast<int>(content.size()), buffer);
-		(*current)["begin"] = offsetValue + 1;
-		(*current)["end"] = offsetValue + content.size();
-		(*_data)["offset"]= offsetValue + content.size() ;
+json * MyFs::inode(const std::uint64_t number) const {
+	return &_data->at("inodes").at(std::to_string(number));
+}
 
-    }else if( static_cast<int>(content.size()) == (current_size)){
-    	// if the size of the content is equal to the current size, this file there is no need to resize the block device
-    	blkdevsim->write(offsetValue + 1,static_cast<int>(content.size()), buffer);
-    }else {
-		resize_bd(current, content, buffer);
-    }
-	delete[] buffer;
-	VFS::write_json_file();
+json * MyFs::inode_of(const json &file) const {
+	return inode(file.at("inode").get<std::uint64_t>());
 }
 
+std::uint64_t MyFs::new_inode() const {
+	const std::uint64_t number = (*_data)["next_inode"];
+	(*_data)["next_inode"] = number + 1;
+	(*_data)["inodes"][std::to_string(number)] = {
+		{"size", 0},
+		{"extents", json::array()} // (offset, size) pairs in file order
+	};
+	return number;
+}
 
+std::vector<std::pair<int, int>> MyFs::extents_of(const json &inode) {
+	std::vector<std::pair<int, int>> extents;
+	for (const auto & extent : inode.at("extents")) {
+		extents.emplace_back(extent[0], extent[1]);
+	}
+	return extents;
+}
 
-void MyFs::adjust_offsets(json &node, int origin_begin, int chunk_to_cut_from_begin_and_end) {
-	// Check if the node is a directory
-	if (node.contains("type") && node["type"] == "directory") {
-		// Iterate through the contents of the directory
-		for (auto& item : node["contents"].items()) {
-			adjust_offsets(item.value(), origin_begin, chunk_to_cut_from_begin_and_end);
+std::vector<std::pair<int, int>> MyFs::extents_of(const json &inode, const int size) {
+	return slice(extents_of(inode), 0, size);
+}
+
+std::vector<std::pair<int, int>> MyFs::slice(const std::vector<std::pair<int, int>> &extents, int offset, int length) {
+	std::vector<std::pair<int, int>> ranges;
+	for (const auto & [begin, size] : extents) {
+		if (length <= 0) break;
+		if (offset >= size) {
+			offset -= size;
+			continue;
 		}
-	} else if (node.contains("type") && node["type"] == "file") {
-		// Adjust the 'begin' and 'end' values for files
-		if (node.contains("begin") && node["begin"].get<int>() > origin_begin) {
-			node["begin"] = node["begin"].get<int>() - chunk_to_cut_from_begin_and_end;
-			node["end"] = node["end"].get<int>() - chunk_to_cut_from_begin_and_end;
+		const int taken = std::min(size - offset, length);
+		ranges.emplace_back(begin == HOLE ? HOLE : begin + offset, taken);
+		length -= taken;
+		offset = 0;
+	}
+	return ranges;
+}
+
+void MyFs::read_inode(const json &inode, const int offset, const int length, char *buffer) const {
+	// tiny files are served straight from the metadata
+	if (inode.contains("inline")) {
+		std::string content(inode.at("size").get<int>(), '\0');
+		from_hex(inode.at("inline"), content.data());
+		std::memcpy(buffer, content.data() + offset, length);
+		return;
+	}
+
+	// compressed files unpack only the chunks holding the range
+	if (inode.contains("chunks")) {
+		const json & table = inode.at("chunks");
+		// a chunk the range covers whole unpacks straight into the buffer, one it covers in part
+		// into a buffer each thread keeps, readers run in parallel
+		thread_local std::vector<char> chunk(COMPRESSED_CHUNK_SIZE);
+		for (int position = offset; position < offset + length;) {
+			const json & entry = table.at(position / COMPRESSED_CHUNK_SIZE);
+			const int from = position % COMPRESSED_CHUNK_SIZE;
+			const int taken = std::min(COMPRESSED_CHUNK_SIZE - from, offset + length - position);
+			if (taken == COMPRESSED_CHUNK_SIZE) {
+				read_chunk({entry[0], entry[1], entry[2]}, buffer + (position - offset));
+			} else {
+				read_chunk({entry[0], entry[1], entry[2]}, chunk.data());
+				std::memcpy(buffer + (position - offset), chunk.data() + from, taken);
+			}
+			position += taken;
+		}
+		return;
+	}
+
+	// gather each run of stored extents into the buffer with one vectored read, holes read as zeros
+	const std::vector<std::pair<int, int>> extents = slice(extents_of(inode), offset, length);
+	for (auto run = extents.begin(); run != extents.end();) {
+		if (run->first == HOLE) {
+			std::memset(buffer, 0, run->second);
+			buffer += run->second;
+			++run;
+			continue;
+		}
+		const auto end = std::find_if(run, extents.end(), [](const auto & extent) { return extent.first == HOLE; });
+		const std::vector<std::pair<int, int>> stored(run, end);
+		blkdevsim->readv(stored, buffer);
+		for (; run != end; ++run) {
+			buffer += run->second;
 		}
 	}
 }
 
+void MyFs::write_inode(const std::uint64_t number, json &inode, const char *buffer, const int size) const {
+	if (inode.contains("chunks")) {
+		const std::vector<Chunk> old = chunks_of(inode);
+		set_chunks(inode, store_chunks(buffer, size));
+		free_chunks(old);
+		inode["size"] = size;
+		return;
+	}
+	std::vector<std::pair<int, int>> extents = extents_of(inode);
+
+	if (size > 0 && size <= _inline_threshold) {
+		// tiny files are kept in the inode itself and use no device space
+		free_extents(extents);
+		inode["size"] = size;
+		inode["extents"] = json::array();
+		inode["inline"] = to_hex(buffer, size);
+		return;
+	}
+	// storage the file stops using is freed only once the new content is in place, so a full device
+	// leaves the file as it was
+	std::vector<std::pair<int, int>> released;
+
+	// every byte is rewritten, so holes have nothing left to save and extents shared with clones
+	// are left to them
+	std::vector<std::pair<int, int>> kept;
+	{
+		std::lock_guard space(_space_lock);
+		for (const auto & extent : extents) {
+			if (extent.first == HOLE) continue;
+			if (!_slabs.owns(extent.first) && !_refs.shared(extent.first, extent.second).empty()) {
+				released.push_back(extent);
+			} else {
+				kept.push_back(extent);
+			}
+		}
+	}
+	extents = std::move(kept);
+	leave_committed_slot(number, inode, extents);
+
+	if (size > 0 && size <= SlabAllocator::MAX_SLOT_SIZE) {
+		// small files live in a single slot, which they keep as long as their size class holds
+		const int slot_size = SlabAllocator::slot_size_for(size);
+		if (!in_slot(extents) || extents.front().second != slot_size) {
+			std::lock_guard space(_space_lock);
+			if (const int slot = _slabs.allocate(size); slot != -1) {
+				released.insert(released.end(), extents.begin(), extents.end());
+				extents = {{slot, slot_size}};
+				_index.insert(slot, slot + slot_size - 1, number);
+			}
+		}
 
+		if (in_slot(extents) && extents.front().second >= size) {
+			blkdevsim->write(extents.front().first, size, buffer);
+			free_extents(released);
+			inode.erase("inline");
+			inode["size"] = size;
+			inode["extents"] = extents;
+			return;
+		}
+		// without room for a slab page the file is stored in extents like a large one
+	}
+	if (in_slot(extents)) {
+		// the file outgrew its slot, or became empty
+		released.insert(released.end(), extents.begin(), extents.end());
+		extents.clear();
+	}
 
+	int capacity = 0;
+	for (const auto & extent : extents) {
+		capacity += extent.second;
+	}
 
-void MyFs::resize_bd(json * current, const std::string & content, const char * buffer) const {
-	// initlize the data
-	json * root = &(*_data)["/"];
-	const int origin_begin = (*current)["begin"];
-	const int origin_end = (*current)["end"];
-	const int chunk_to_cut_from_begin_and_end = origin_end - origin_begin + 1; // chunk off steps to reduce from each begin and end of a file, that it's begin bigger than the edited file
-	const int chunk_to_cut_from_offset = chunk_to_cut_from_begin_and_end; // size of chunk is equal to #steps, block_device offset needs to go back
-	const int current_offset = (*_data)["offset"];
+	if (size < capacity) {
+		release_tail(extents, size);
+	} else if (size > capacity) {
+		add_capacity(number, extents, size - capacity);
+	}
 
+	write_range(number, extents, 0, buffer, size);
+	free_extents(released);
+	// a file growing past the threshold leaves the metadata
+	inode.erase("inline");
+	inode["size"] = size;
+	inode["extents"] = extents;
+}
 
-	// if the edited file end is not equal to the current device offset, make
-	if(origin_end != current_offset) {
-		(*_data)["offset"] = current_offset - chunk_to_cut_from_offset;
+void MyFs::add_capacity(const std::uint64_t number, std::vector<std::pair<int, int>> &extents, int missing) const {
+	std::lock_guard space(_space_lock);
+	// grow the last extent in place when the bytes after it are free
+	if (!extents.empty() && extents.back().first != HOLE) {
+		auto & [offset, length] = extents.back();
+		if (_allocator.extend(offset, length, missing)) {
+			length += missing;
+			_index.set_end(offset, offset + length - 1);
+			return;
+		}
 	}
 
-	// if we editing a file with new data that exceeds the block_device size, throw exception
-	// offset_ptr - steps_to_go_back  +  new_data_added > Block Device Size
-	if ( ((current_offset - chunk_to_cut_from_begin_and_end) + static_cast<int>(content.size())) > BlockDeviceSimulator::DEVICE_SIZE)
-		throw std::runtime_error("Cannot resize the file: the new size exceeds the block device size");
+	// otherwise add new extents wherever there is free space, nothing already written moves
+	const auto added = _allocator.allocate_scattered(missing);
+	if (added.empty())
+		throw std::runtime_error("Cannot resize the file: not enough free space on the block device");
+	for (const auto & [offset, length] : added) {
+		if (!extents.empty() && extents.back().first != HOLE && extents.back().first + extents.back().second == offset) {
+			extents.back().second += length;
+			_index.set_end(extents.back().first, offset + length - 1);
+		} else {
+			extents.emplace_back(offset, length);
+			_index.insert(offset, offset + length - 1, number);
+		}
+	}
+}
 
-    // if the file to be edited end equal to the block device offset, we need to treat this file in a different way
-	// we need either to squeez the end or to extend it
-	if(origin_end == current_offset) {
-		const bool is_bigger = chunk_to_cut_from_begin_and_end < static_cast<int>(content.size());
-		const int differ = !is_bigger?
-			                   chunk_to_cut_from_begin_and_end - content.size():content.size() - chunk_to_cut_from_begin_and_end;
-		blkdevsim->write(origin_begin , static_cast<int>(content.size()), buffer);
-		(*current)["end"] = !is_bigger?origin_end - differ:origin_end + differ;
-		(*_data)["offset"] = !is_bigger?origin_end - differ:origin_end + differ;
+void MyFs::release_tail(std::vector<std::pair<int, int>> &extents, const int size) const {
+	std::lock_guard space(_space_lock);
+	// keep the extents covering size bytes and give the rest back to the allocator
+	int kept = 0;
+	size_t used = 0;
+	for (; used < extents.size() && kept < size; ++used) {
+		auto & [offset, length] = extents[used];
+		if (kept + length > size) {
+			if (offset != HOLE) {
+				release_range(offset + size - kept, length - (size - kept));
+				_index.set_end(offset, offset + size - kept - 1);
+			}
+			length = size - kept;
+		}
+		kept += length;
+	}
+	for (size_t i = used; i < extents.size(); ++i) {
+		if (extents[i].first == HOLE) continue;
+		release_range(extents[i].first, extents[i].second);
+		_index.erase(extents[i].first);
+	}
+	extents.resize(used);
+}
 
-	} else {
-		// first of all we need to adjust all files begin and end where begin > the current begin edited_file
-		adjust_offsets(*root, origin_begin, chunk_to_cut_from_begin_and_end);
+std::vector<std::pair<int, int>> MyFs::pieces(const std::vector<std::pair<int, int>> &extents, const int offset,
+                                              const int length, std::vector<bool> &shared) const {
+	std::vector<std::pair<int, int>> pieces;
+	shared.clear();
+	std::lock_guard space(_space_lock);
+	for (const auto & [begin, size] : slice(extents, offset, length)) {
+		int position = begin;
+		if (begin != HOLE) {
+			for (const auto & [shared_begin, shared_length] : _refs.shared(begin, size)) {
+				if (shared_begin > position) {
+					pieces.emplace_back(position, shared_begin - position);
+					shared.push_back(false);
+				}
+				pieces.emplace_back(shared_begin, shared_length);
+				shared.push_back(true);
+				position = shared_begin + shared_length;
+			}
+		}
+		if (begin == HOLE || position < begin + size) {
+			pieces.emplace_back(position, begin == HOLE ? size : begin + size - position);
+			shared.push_back(false);
+		}
+	}
+	return pieces;
+}
 
-		int block_device_begin_to_copy = origin_end + 1; // copy begin from here
-		int size_chunck_to_copy_in_block_device = current_offset - block_device_begin_to_copy + 1;
-		char *ans = new char [size_chunck_to_copy_in_block_device];
+void MyFs::splice(std::vector<std::pair<int, int>> &extents, const int offset, const int length,
+                  const std::vector<std::pair<int, int>> &replacement) {
+	std::vector<std::pair<int, int>> spliced;
+	const auto add = [&spliced](const int begin, const int size) {
+		// neighbouring holes are kept as one
+		if (begin == HOLE && !spliced.empty() && spliced.back().first == HOLE) {
+			spliced.back().second += size;
+		} else {
+			spliced.emplace_back(begin, size);
+		}
+	};
+
+	int position = 0;
+	bool replaced = false;
+	for (const auto & [begin, size] : extents) {
+		const int end = position + size;
+		if (position < offset) {
+			add(begin, std::min(size, offset - position));
+		}
+		if (!replaced && end > offset) {
+			for (const auto & [piece_begin, piece_size] : replacement) {
+				add(piece_begin, piece_size);
+			}
+			replaced = true;
+		}
+		if (end > offset + length) {
+			const int from = std::max(position, offset + length);
+			add(begin == HOLE ? HOLE : begin + from - position, end - from);
+		}
+		position = end;
+	}
+	extents = std::move(spliced);
+}
 
-		// copy all the data above the end of the current edited file to the block device offset
-		blkdevsim->read(block_device_begin_to_copy, size_chunck_to_copy_in_block_device, ans); // copy
+void MyFs::clear_range(std::vector<std::pair<int, int>> &extents, const int offset, const int length) const {
+	if (length <= 0) return;
+	std::vector<bool> shared;
+	const std::vector<std::pair<int, int>> replacement = pieces(extents, offset, length, shared);
+
+	// private bytes are zeroed in place, shared ones are left to the other files and become a hole
+	const std::vector<char> zeros(length, '\0');
+	int position = offset;
+	for (size_t i = 0; i < replacement.size(); ++i) {
+		const auto [begin, size] = replacement[i];
+		if (shared[i]) {
+			release_range(begin, size);
+			splice(extents, position, size, {{HOLE, size}});
+		} else if (begin != HOLE) {
+			blkdevsim->write(begin, size, zeros.data());
+		}
+		position += size;
+	}
+}
 
-		// paster it to the begining of the begin of the current file to be edited
-		blkdevsim->write(origin_begin, size_chunck_to_copy_in_block_device, ans); // paste
+void MyFs::own_range(const std::uint64_t number, std::vector<std::pair<int, int>> &extents, const int offset,
+                     const int length, const bool keep_content) const {
+	std::vector<bool> shared;
+	const std::vector<std::pair<int, int>> old_pieces = pieces(extents, offset, length, shared);
 
-		delete [] ans;
-		const int current_new_offset = (*_data)["offset"];
+	// allocate for every hole and shared piece at once, so a full device leaves the file untouched
+	int missing = 0;
+	for (size_t i = 0; i < old_pieces.size(); ++i) {
+		if (shared[i] || old_pieces[i].first == HOLE) missing += old_pieces[i].second;
+	}
+	if (missing == 0) return;
+	const auto added = [&] {
+		std::lock_guard space(_space_lock);
+		return _allocator.allocate_scattered(missing);
+	}();
+	if (added.empty())
+		throw std::runtime_error("Cannot write the file: not enough free space on the block device");
+
+	auto next = added.begin();
+	int next_used = 0;
+	std::vector<char> buffer;
+	int position = offset;
+	for (size_t i = 0; i < old_pieces.size(); ++i) {
+		const auto [begin, size] = old_pieces[i];
+		position += size;
+		if (!shared[i] && begin != HOLE) continue;
+		std::vector<std::pair<int, int>> replacement;
+
+		// the piece moves to private space: holes read as zeros there, shared bytes are copied
+		if (keep_content) {
+			buffer.assign(size, '\0');
+			if (begin != HOLE) blkdevsim->read(begin, size, buffer.data());
+		}
+		for (int done = 0; done < size;) {
+			const int taken = std::min(size - done, next->second - next_used);
+			const int to = next->first + next_used;
+			if (keep_content) blkdevsim->write(to, taken, buffer.data() + done);
+			replacement.emplace_back(to, taken);
+			{
+				std::lock_guard space(_space_lock);
+				_index.insert(to, to + taken - 1, number);
+			}
+			done += taken;
+			next_used += taken;
+			if (next_used == next->second) {
+				++next;
+				next_used = 0;
+			}
+		}
+		if (shared[i]) release_range(begin, size);
 
-		// add the edited file new data to the end of the block_device offset
-		blkdevsim->write(current_new_offset + 1, static_cast<int>(content.size()), buffer);
-		(*current)["begin"] = current_new_offset + 1 ; // new location begin
-		(*current)["end"] = current_new_offset + content.size(); // new location end
-		(*_data)["offset"] =  current_new_offset + content.size(); // new location for the offset
+		// only the extents holding the piece are split, the file's private extents stay whole
+		splice(extents, position - size, size, replacement);
 	}
 }
 
-void MyFs::list_dir(const std::string &path_str) const {
-	// Start from the root directory
-	json* current = &(*_data)["/"];
-	if(path_str == "/") {
-		for (auto& item : (*current)["contents"].items()) {
-			if((*current)["contents"][item.key()]["type"] == "file") {
-				const int  begin =  (*current)["contents"][item.key()]["begin"];
-				const int  end =  (*current)["contents"][item.key()]["end"];
-				if(begin == -1 || end == -1) {
-					std::cout << item.key() << '\t' <<  0 << std::endl;
-				}else {
-					std::cout << item.key() << '\t' <<  end-begin+1 << std::endl;
+void MyFs::write_range(const std::uint64_t number, std::vector<std::pair<int, int>> &extents, const int offset,
+                       const char *buffer, const int length) const {
+	if (!_dedup) {
+		// holes and bytes shared with clones are replaced, never written through
+		own_range(number, extents, offset, length, false);
+		blkdevsim->writev(slice(extents, offset, length), buffer);
+		return;
+	}
+
+	// the caller holds the space lock for the whole write, see space_for_write()
+	constexpr int CHUNK = ChunkIndex::CHUNK_SIZE;
+	std::vector<char> stored(CHUNK);
+	bool deduplicated = false;
+	for (int position = offset; position < offset + length;) {
+		// chunks sit at fixed file offsets, a write covers whole chunks plus a partial one at each end
+		const int size = std::min(offset + length, (position / CHUNK + 1) * CHUNK) - position;
+		const char * data = buffer + (position - offset);
+		const std::uint64_t hash = size == CHUNK ? ChunkIndex::hash(data, CHUNK) : 0;
+
+		// the hash only names a candidate, the stored bytes have to match as well
+		const int found = size == CHUNK ? _chunks.find(hash) : -1;
+		if (found != -1) {
+			blkdevsim->read(found, CHUNK, stored.data());
+		}
+		if (found != -1 && std::memcmp(stored.data(), data, CHUNK) == 0) {
+			const std::vector<std::pair<int, int>> old = slice(extents, position, CHUNK);
+			if (old.size() != 1 || old.front().first != found) {
+				// the stored copy gets a reference before the chunk's old ranges drop theirs, in case
+				// they overlap. Both stop being indexed: the copy is shared and the file's extents
+				// around the chunk are split
+				_refs.share(found, CHUNK);
+				_index.erase_range(found, CHUNK);
+				for (const auto & [begin, piece] : old) {
+					if (begin != HOLE) _index.erase_range(begin, piece);
 				}
-			}else {
-				std::cout << item.key() << std::endl;
+				splice(extents, position, CHUNK, {{found, CHUNK}});
+				for (const auto & [begin, piece] : old) {
+					if (begin != HOLE) release_range(begin, piece);
+				}
+				deduplicated = true;
+			}
+		} else {
+			own_range(number, extents, position, size, false);
+			const std::vector<std::pair<int, int>> ranges = slice(extents, position, size);
+			blkdevsim->writev(ranges, data);
+			if (size == CHUNK && ranges.size() == 1) {
+				_chunks.insert(hash, ranges.front().first);
 			}
+		}
+		position += size;
+	}
 
+	// the extents the chunks were cut out of go back into the index where the file still owns them
+	if (deduplicated) {
+		for (const auto & [begin, size] : extents) {
+			if (begin == HOLE || !_refs.shared(begin, size).empty()) continue;
+			_index.insert(begin, begin + size - 1, number);
 		}
+	}
+}
+
+void MyFs::unpack(const std::uint64_t number, json &inode, std::vector<std::pair<int, int>> &extents) const {
+	// the content is at most a slab slot, it is copied out before its storage is freed
+	const int size = inode["size"];
+	std::vector<char> content(size);
+	read_inode(inode, 0, size, content.data());
+
+	std::vector<std::pair<int, int>> moved;
+	if (size > 0) {
+		add_capacity(number, moved, size);
+		blkdevsim->writev(moved, content.data());
+	}
+	free_extents(extents);
+	extents = std::move(moved);
+	inode.erase("inline");
+	inode["extents"] = extents;
+}
+
+void MyFs::write_inode_at(const std::uint64_t number, json &inode, const int offset, const char *buffer,
+                          const int size) const {
+	if (size == 0) return;
+	if (inode.contains("chunks")) {
+		write_compressed(inode, offset, buffer, size);
 		return;
 	}
-	// Traverse the path
-	const std::vector<std::string> tokens = VFS::split_cmd(path_str, '/');
-	current = traverse(current,tokens);
+	const int old_size = inode["size"];
+	const int new_size = std::max(old_size, offset + size);
+	std::vector<std::pair<int, int>> extents = extents_of(inode);
+	leave_committed_slot(number, inode, extents);
+
+	const bool in_slot = this->in_slot(extents);
+	if (extents.empty() || (in_slot && new_size > extents.front().second)) {
+		if (new_size <= SlabAllocator::MAX_SLOT_SIZE) {
+			// the file is empty, inline, or outgrows its slot: its content is at most a slab slot,
+			// so it is rebuilt in memory and stored wherever its new size belongs
+			std::vector<char> content(new_size, '\0');
+			read_inode(inode, 0, old_size, content.data());
+			std::memcpy(content.data() + offset, buffer, size);
+			write_inode(number, inode, content.data(), new_size);
+			return;
+		}
+		// a file leaving its slot or the metadata for good is written like any large file
+		unpack(number, inode, extents);
+	}
 
-	// Check if it's a directory
-	if ((*current)["type"] != "directory") {
-		throw std::runtime_error("Path does not refer to a directory");
+	int capacity = 0;
+	for (const auto & extent : extents) {
+		capacity += extent.second;
 	}
 
-	// List the contents of the directory
-	for (auto& item : (*current)["contents"].items()) {
-		if((*current)["contents"][item.key()]["type"] == "file") {
-			const int  begin =  (*current)["contents"][item.key()]["begin"];
-			if(const int end =  (*current)["contents"][item.key()]["end"]; begin == -1 || end == -1) {
-				std::cout << item.key() << '\t' <<  0 << std::endl;
-			}else {
-				std::cout << item.key() << '\t' <<  end-begin+1 << std::endl;
+	// bytes between the old end and the write were never written, they must read as zeros: those
+	// in the capacity are cleared, those past it become a hole
+	if (offset > old_size) {
+		clear_range(extents, old_size, std::min(offset, capacity) - old_size);
+		inode["extents"] = extents;
+	}
+	if (offset > capacity) {
+		extents.emplace_back(HOLE, offset - capacity);
+		capacity = offset;
+	}
+
+	// use the slack after the data first, then extend the file in place or add a new extent
+	if (new_size > capacity) {
+		add_capacity(number, extents, new_size - capacity);
+		inode["extents"] = extents;
+	}
+	// overwrites go straight to the device ranges holding them
+	try {
+		write_range(number, extents, offset, buffer, size);
+	} catch (std::runtime_error &) {
+		// a deduplicating write can run out of space part way, the chunks it stored are kept
+		inode["extents"] = extents;
+		throw;
+	}
+	inode["size"] = new_size;
+	inode["extents"] = extents;
+}
+
+std::vector<MyFs::Chunk> MyFs::chunks_of(const json &inode) {
+	std::vector<Chunk> chunks;
+	for (const auto & chunk : inode.at("chunks")) {
+		chunks.push_back({chunk[0], chunk[1], chunk[2]});
+	}
+	return chunks;
+}
+
+void MyFs::set_chunks(json &inode, const std::vector<Chunk> &chunks) {
+	json table = json::array();
+	for (const auto & chunk : chunks) {
+		table.push_back({chunk.offset, chunk.stored, chunk.length}); // (offset, stored, length) triples
+	}
+	inode["chunks"] = std::move(table);
+}
+
+void MyFs::read_chunk(const Chunk &chunk, char *out) const {
+	int length = 0;
+	if (chunk.offset != HOLE && chunk.stored == chunk.length) {
+		blkdevsim->read(chunk.offset, chunk.stored, out);
+		length = chunk.length;
+	} else if (chunk.offset != HOLE) {
+		// a packed chunk is smaller than its content, so it always fits
+		thread_local std::vector<char> packed(COMPRESSED_CHUNK_SIZE);
+		if (chunk.stored > COMPRESSED_CHUNK_SIZE) throw std::runtime_error("Compressed chunk is corrupt");
+		blkdevsim->read(chunk.offset, chunk.stored, packed.data());
+		length = Compressor::decompress(packed.data(), chunk.stored, out, COMPRESSED_CHUNK_SIZE);
+		if (length != chunk.length) throw std::runtime_error("Compressed chunk is corrupt");
+	}
+	std::memset(out + length, 0, COMPRESSED_CHUNK_SIZE - length);
+}
+
+std::vector<MyFs::Chunk> MyFs::store_chunks(const char *buffer, const int size) const {
+	std::vector<Chunk> chunks;
+	std::vector<char> packed;
+	packed.reserve(size);
+	for (int position = 0; position < size; position += COMPRESSED_CHUNK_SIZE) {
+		const int length = std::min(COMPRESSED_CHUNK_SIZE, size - position);
+		const char * data = buffer + position;
+		if (std::all_of(data, data + length, [](const char byte) { return byte == '\0'; })) {
+			chunks.push_back({HOLE, 0, 0});
+			continue;
+		}
+
+		// a chunk that does not shrink is stored as it is
+		const size_t at = packed.size();
+		packed.resize(at + length);
+		int stored = Compressor::compress(data, length, packed.data() + at, length - 1);
+		if (stored == 0) {
+			std::memcpy(packed.data() + at, data, length);
+			stored = length;
+		}
+		packed.resize(at + stored);
+		chunks.push_back({0, stored, length});
+	}
+
+	// every chunk gets its space before anything is written
+	std::unique_lock space(_space_lock);
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		if (chunks[i].offset == HOLE) continue;
+		chunks[i].offset = _allocator.allocate(chunks[i].stored);
+		if (chunks[i].offset == -1) {
+			for (size_t j = 0; j < i; ++j) {
+				if (chunks[j].offset != HOLE) _allocator.release(chunks[j].offset, chunks[j].stored);
 			}
-		}else {
-			std::cout << item.key() << std::endl;
+			throw std::runtime_error("Cannot write the file: not enough free space on the block device");
 		}
 	}
+	space.unlock();
+	const char * from = packed.data();
+	for (const auto & chunk : chunks) {
+		if (chunk.offset == HOLE) continue;
+		blkdevsim->write(chunk.offset, chunk.stored, from);
+		from += chunk.stored;
+	}
+	return chunks;
 }
 
-void MyFs::remove_file(const std::string &path_str ){
-	const std::vector<std::string> tokens = VFS::split_cmd(path_str, '/');
-	json * current = &(*_data)["/"];
-	json * root = &(*_data)["/"];
-	// Locate the file in the JSON structure
-	current = traverse(current, tokens);
+void MyFs::free_chunks(const std::vector<Chunk> &chunks) const {
+	for (const auto & chunk : chunks) {
+		if (chunk.offset != HOLE) release_range(chunk.offset, chunk.stored);
+	}
+}
 
-	// Check if the path refers to a file
-	if ((*current)["type"] != "file") {
-		throw std::runtime_error("Path does not refer to a file");
+void MyFs::write_compressed(json &inode, const int offset, const char *buffer, const int size) const {
+	const int old_size = inode["size"];
+	const int new_size = std::max(old_size, offset + size);
+	std::vector<Chunk> chunks = chunks_of(inode);
+
+	// the chunks the write touches are rebuilt in memory from their old bytes and the new ones,
+	// chunks between the old end and the write stay holes
+	const int first = offset / COMPRESSED_CHUNK_SIZE;
+	const int last = (offset + size - 1) / COMPRESSED_CHUNK_SIZE;
+	const int begin = first * COMPRESSED_CHUNK_SIZE;
+	const int end = std::min(new_size, (last + 1) * COMPRESSED_CHUNK_SIZE);
+	std::vector<char> content(end - begin, '\0');
+	if (old_size > begin) {
+		read_inode(inode, begin, std::min(old_size, end) - begin, content.data());
 	}
+	std::memcpy(content.data() + (offset - begin), buffer, size);
+	const std::vector<Chunk> packed = store_chunks(content.data(), end - begin);
+
+	chunks.resize(std::max<size_t>(chunks.size(), last + 1), {HOLE, 0, 0});
+	const std::vector<Chunk> replaced(chunks.begin() + first, chunks.begin() + last + 1);
+	std::copy(packed.begin(), packed.end(), chunks.begin() + first);
+	free_chunks(replaced);
+	inode["size"] = new_size;
+	set_chunks(inode, chunks);
+}
 
-	const int origin_begin = (*current)["begin"];
-	const int origin_end = (*current)["end"];
-	const int chunk_to_cut_from_begin_and_end = origin_end - origin_begin + 1; // chunk off steps to reduce from each begin and end of a file, that it's begin bigger than the edited file
-	const int chunk_to_cut_from_offset = chunk_to_cut_from_begin_and_end; // size of chunk is equal to #steps, block_device offset needs to go back
-	const int current_offset_blkdev = (*_data)["offset"];
+void MyFs::truncate_compressed(json &inode, const int new_size) const {
+	const int old_size = inode["size"];
+	std::vector<Chunk> chunks = chunks_of(inode);
+	const size_t count = (new_size + COMPRESSED_CHUNK_SIZE - 1) / COMPRESSED_CHUNK_SIZE;
+
+	if (new_size < old_size) {
+		std::vector<Chunk> dropped(chunks.begin() + static_cast<long>(count), chunks.end());
+		// the last chunk is repacked without the bytes past the new end, they must read as zeros
+		// if the file grows again
+		const int tail = new_size % COMPRESSED_CHUNK_SIZE;
+		if (tail != 0 && chunks[count - 1].length > tail) {
+			std::vector<char> content(tail);
+			read_inode(inode, new_size - tail, tail, content.data());
+			dropped.push_back(chunks[count - 1]);
+			chunks[count - 1] = store_chunks(content.data(), tail).front();
+		}
+		chunks.resize(count);
+		free_chunks(dropped);
+	} else {
+		// growing adds chunks of zeros, which take no space
+		chunks.resize(count, {HOLE, 0, 0});
+	}
+	inode["size"] = new_size;
+	set_chunks(inode, chunks);
+}
 
-	// Remove the file entry from the JSON structure
-	json * parent;
-	if(tokens.size() > 1) {
-		parent = get_parent(root, tokens);
-	}else {
-		parent = root;
+void MyFs::free_extents(const std::vector<std::pair<int, int>> &extents) const {
+	std::lock_guard space(_space_lock);
+	for (const auto & [offset, length] : extents) {
+		if (offset == HOLE) continue;
+		if (_slabs.owns(offset)) {
+			_released_slots.push_back(offset);
+		} else {
+			release_range(offset, length);
+		}
+		_index.erase(offset);
 	}
+}
 
+bool MyFs::in_slot(const std::vector<std::pair<int, int>> &extents) const {
+	if (extents.empty()) return false;
+	std::lock_guard space(_space_lock);
+	return _slabs.owns(extents.front().first);
+}
 
-	if(origin_begin == -1 || origin_end == -1) {
-		parent->at("contents").erase(tokens.back());
-		VFS::write_json_file();
-		return;
+std::unique_lock<std::recursive_mutex> MyFs::space_for_write() const {
+	if (!_dedup) return {};
+	return std::unique_lock(_space_lock);
+}
+
+void MyFs::release_range(const int offset, const int length) const {
+	std::lock_guard space(_space_lock);
+	// bytes still used by a clone stay allocated, the rest waits for readers of older versions
+	for (const auto & [begin, size] : _refs.release(offset, length)) {
+		_released.emplace_back(begin, size);
+		_chunks.forget(begin, size);
+	}
+}
+
+void MyFs::release_inode(json &file) const {
+	_handles.invalidate(file.at("inode"));
+	free_extents(extents_of(*inode_of(file)));
+	if (inode_of(file)->contains("chunks")) {
+		free_chunks(chunks_of(*inode_of(file)));
 	}
+	(*_data)["inodes"].erase(std::to_string(file.at("inode").get<std::uint64_t>()));
+}
+
+int MyFs::open(const std::string &path_str, const bool truncate) const {
+	// only truncating changes the file
+	std::optional<Mutation> mutation;
+	if (truncate) mutation.emplace(*this);
+	int fd = -1;
+	[&] {
+		std::shared_lock tree(_lock);
+		std::shared_lock<RwLock> inodes;
+		const std::uint64_t number = file_of(path_str, inodes);
+		json * inode = this->inode(number);
+		if (truncate) {
+			std::unique_lock file(inode_lock(number));
+			const auto space = space_for_write();
+			if (inode->at("size") != 0) {
+				changed_inode(number);
+				write_inode(number, *inode, nullptr, 0);
+			}
+		}
 
-	// resize offset
-	(*_data)["offset"] = current_offset_blkdev - chunk_to_cut_from_offset;
+		// the path is resolved once, the handle keeps the inode
+		fd = _handles.open(number, inode);
+	}();
+	save_changes();
+	return fd;
+}
 
-	if(origin_end != current_offset_blkdev) {
-		adjust_offsets(*root, origin_begin, chunk_to_cut_from_begin_and_end);
+std::string MyFs::read(const int fd, const int length) const {
+	std::string content(std::max(length, 0), '\0');
+	content.resize(read(fd, content.data(), length));
+	return content;
+}
 
-		const int block_device_begin_to_copy = origin_end + 1; // copy begin from here
+int MyFs::read(const int fd, char *buffer, const int length) const {
+	std::shared_lock tree(_lock);
+	if (length < 0) throw std::runtime_error("Length must not be negative");
+
+	// a copy of the handle, its record stays while the inode table is held
+	std::shared_lock inodes(_inodes_lock);
+	const HandleTable::Handle handle = _handles.get(fd);
+	std::shared_lock file(inode_lock(handle.inode));
+	const int size = handle.record->at("size");
+	const int count = std::max(0, std::min(length, size - handle.position));
+	read_inode(*handle.record, handle.position, count, buffer);
+	_handles.set_position(fd, handle.position + count);
+	return count;
+}
 
-		const int size_chunck_to_copy_in_block_device = current_offset_blkdev - block_device_begin_to_copy + 1;
+void MyFs::write(const int fd, const std::string_view bytes) const {
+	const Mutation mutation(*this);
+	[&] {
+		std::shared_lock tree(_lock);
+		std::shared_lock inodes(_inodes_lock);
+		const HandleTable::Handle handle = _handles.get(fd);
+		std::unique_lock file(inode_lock(handle.inode));
+		const auto space = space_for_write();
+		changed_inode(handle.inode);
+		write_inode_at(handle.inode, *handle.record, handle.position, bytes.data(), static_cast<int>(bytes.size()));
+		_handles.set_position(fd, handle.position + static_cast<int>(bytes.size()));
+	}();
+	save_changes();
+}
 
-		// buffer to read
-		char *ans = new char [size_chunck_to_copy_in_block_device];
+int MyFs::seek(const int fd, const int offset, const Whence whence) const {
+	std::shared_lock tree(_lock);
+	std::shared_lock inodes(_inodes_lock);
+	const HandleTable::Handle handle = _handles.get(fd);
+
+	int position = offset;
+	if (whence == Whence::CURRENT) {
+		position += handle.position;
+	} else if (whence == Whence::END) {
+		std::shared_lock file(inode_lock(handle.inode));
+		position += handle.record->at("size").get<int>();
+	}
+	if (position < 0) throw std::runtime_error("Cannot seek before the beginning of the file");
 
-		// copy all the data followed by the end of the current edited file up to the block device offset
-		blkdevsim->read(block_device_begin_to_copy, size_chunck_to_copy_in_block_device, ans); // copy
+	_handles.set_position(fd, position);
+	return position;
+}
 
-		// paste it to the begining of the current file to be edited
-		blkdevsim->write(origin_begin, size_chunck_to_copy_in_block_device, ans); // paste
+void MyFs::close(const int fd) const {
+	std::shared_lock lock(_lock);
+	_handles.close(fd);
+}
 
-		delete [] ans;
-	}else {
-		// just re-locate the block device ptr to the beginning of the deleted file, the data will be overwritten;
-		// this will automatically happen, no need to do any changes
+void MyFs::list_dir(const std::string &path_str) const {
+	const auto pin = _epochs.pin();
+	const Version & version = *_version.load(std::memory_order_acquire);
+	// Start from the root directory
+	const ReadDirectory * current = version.root.get();
+	if (path_str != "/") {
+		// Traverse the path
+		current = find_in(version, VFS::split_cmd(path_str, '/')).directory;
 	}
 
-	parent->at("contents").erase(tokens.back());
+	// Check if it's a directory
+	if (current == nullptr) {
+		throw std::runtime_error("Path does not refer to a directory");
+	}
 
-	// Write changes to the JSON file
+	// List the contents of the directory
+	current->entries.for_each([&](const std::string &name, const ReadEntry &entry) {
+		if (entry.directory == nullptr) {
+			const int size = inode_in(version, entry.inode).at("size");
+			std::cout << name << '\t' <<  size << std::endl;
+		}else {
+			std::cout << name << std::endl;
+		}
+	});
+}
 
-	VFS::write_json_file();
+void MyFs::remove_file(const std::string &path_str ){
+	const Mutation mutation(*this);
+	[&] {
+		std::shared_lock tree(_lock);
+		const std::vector<std::string> names = names_of(path_str);
+		if (names.empty()) throw std::runtime_error("Path does not refer to a file");
+
+		// Locate the file in the JSON structure
+		json * parent = parent_of(names);
+		std::unique_lock entries(directory_lock(*parent));
+		json * current = find_entry(*parent, names.back());
+		if (current == nullptr) throw std::runtime_error("File or directory not found");
+
+		// Check if the path refers to a file
+		if ((*current)["type"] != "file") {
+			throw std::runtime_error("Path does not refer to a file");
+		}
+
+		// give the file's extents back to the allocator, no other file is moved
+		std::unique_lock inodes(_inodes_lock);
+		const std::uint64_t number = current->at("inode");
+		release_inode(*current);
 
+		// Remove the file entry from the JSON structure
+		parent->at("contents").erase(names.back());
+		changed_entries({{names.begin(), names.end() - 1}}, {number});
+	}();
+
+	// Write changes to the JSON file
+	save_changes();
 }
 
-void MyFs::recursive_delete(json *current, const std::string& path_str,  std::vector<std::string>  & paths)  {
-	for (auto& item : (*current)["contents"].items()) {
+void MyFs::recursive_delete(const json *current, std::vector<std::uint64_t> &inodes)  {
+	for (const auto& item : current->at("contents").items()) {
 		if (item.value()["type"] == "file") {
-			// If it's a file, remove it using remove_file
-			std::string file_path;
-			if(path_str != "/") {
-				file_path = path_str + "/" + item.key();
-			}else {
-				file_path = path_str + item.key();
-			}
-			paths.push_back(file_path);
+			inodes.push_back(item.value()["inode"]);
 		} else if (item.value()["type"] == "directory") {
-			// If it's a directory, recursively delete its contents
-			std::string dir_path;
-			if(path_str != "/") {
-				dir_path = path_str + "/" + item.key();
-			}else {
-				dir_path = path_str + item.key();
-			}
-			recursive_delete(&item.value(), dir_path, paths);
-
+			// If it's a directory, recursively collect its contents
+			recursive_delete(&item.value(), inodes);
 		}
 	}
 }
 
 void MyFs::remove_dir(const std::string &path_str){
+	const Mutation mutation(*this);
+	std::lock_guard lock(_lock);
 	const std::vector<std::string> tokens = VFS::split_cmd(path_str, '/');
 	json *current = &(*_data)["/"];
 	json *root = &(*_data)["/"];
@@ -433,15 +1597,46 @@ void MyFs::remove_dir(const std::string &path_str){
 		throw std::runtime_error("Path does not refer to a directory");
 	}
 
-	// Recursively delete the directory contents
-
-	std::vector<std::string> paths;
-    recursive_delete(current, path_str,paths);
-
-	for (const auto & file_path : paths) {
-		remove_file(file_path);
+	// Gather every extent of the subtree and free them in a single sorted pass
+	std::vector<std::uint64_t> inodes;
+	recursive_delete(current, inodes);
+
+	std::vector<std::pair<int, int>> extents;
+	for (const auto number : inodes) {
+		changed_inode(number);
+		_handles.invalidate(number);
+		for (const auto & extent : extents_of(*inode(number))) {
+			if (extent.first == HOLE) continue;
+			if (_slabs.owns(extent.first)) {
+				_released_slots.push_back(extent.first);
+			} else {
+				for (const auto & [begin, size] : _refs.release(extent.first, extent.second)) {
+					_chunks.forget(begin, size);
+					extents.emplace_back(begin, size);
+				}
+			}
+			_index.erase(extent.first);
+		}
+		if (inode(number)->contains("chunks")) {
+			for (const auto & chunk : chunks_of(*inode(number))) {
+				if (chunk.offset == HOLE) continue;
+				for (const auto & [begin, size] : _refs.release(chunk.offset, chunk.stored)) {
+					_chunks.forget(begin, size);
+					extents.emplace_back(begin, size);
+				}
+			}
+		}
+		(*_data)["inodes"].erase(std::to_string(number));
 	}
+	_released.insert(_released.end(), extents.begin(), extents.end());
 
+	if (current == root) {
+		// the root itself stays, only its contents go
+		(*root)["contents"] = json::object();
+		changed_entries({});
+		flush();
+		return;
+	}
 
     // Erase the directory entry from its parent
     if (tokens.size() > 1) {
@@ -453,7 +1648,711 @@ void MyFs::remove_dir(const std::string &path_str){
     if (parent) {
         parent->at("contents").erase(tokens.back());
     }
+    const std::vector<std::string> names = names_of(path_str);
+    changed_entries({names.begin(), names.end() - 1});
 
     // Write changes to the JSON file
-    VFS::write_json_file();
-}
\ No newline at end of file
+    flush();
+}
+
+void MyFs::set_json_data(json &data) {
+	std::lock_guard lock(_lock);
+	_data = &data;
+	_handles.invalidate_all();
+
+	// older instances kept a single high-water mark instead of tracking free space
+	_data->erase("offset");
+	if (!_data->contains("inodes")) {
+		(*_data)["inodes"] = json::object();
+		(*_data)["next_inode"] = 1;
+	}
+	if (!_data->contains("slabs")) {
+		(*_data)["slabs"] = json::array();
+	}
+	upgrade_files((*_data)["/"]);
+
+	// content staged by an edit that never finished belongs to no file
+	for (auto it = (*_data)["inodes"].begin(); it != (*_data)["inodes"].end();) {
+		it = it->contains("staging") ? (*_data)["inodes"].erase(it) : std::next(it);
+	}
+
+	_index.clear();
+	_slabs.clear();
+	_allocator.reset(get_header_size(), BlockDeviceSimulator::DEVICE_SIZE);
+	for (const auto & page : (*_data)["slabs"]) {
+		_allocator.reserve(page[0], SlabAllocator::PAGE_SIZE);
+		_slabs.add_page(page[0], page[1]);
+	}
+	// clones refer to the same ranges, so the space in use is reserved once per range
+	std::vector<std::pair<int, int>> used;
+	for (auto& item : (*_data)["inodes"].items()) {
+		for (const auto & [offset, length] : extents_of(item.value())) {
+			if (offset == HOLE) continue;
+			if (_slabs.owns(offset)) {
+				_slabs.reserve(offset);
+			} else {
+				used.emplace_back(offset, length);
+			}
+		}
+		if (item.value().contains("chunks")) {
+			for (const auto & chunk : chunks_of(item.value())) {
+				if (chunk.offset != HOLE) used.emplace_back(chunk.offset, chunk.stored);
+			}
+		}
+	}
+	for (const auto & [offset, length] : _refs.rebuild(std::move(used))) {
+		_allocator.reserve(offset, length);
+	}
+
+	index_extents();
+	_slabs.release_empty_pages();
+
+	// the setting saved with the metadata wins over one made before it was loaded
+	if (_data->contains("dedup")) {
+		_dedup = _data->at("dedup");
+	} else if (_dedup) {
+		(*_data)["dedup"] = true;
+	}
+	_chunks.clear();
+	if (_dedup) index_chunks();
+
+	// the allocators were rebuilt from the new metadata, space freed before is free already
+	_transaction.reset();
+	release_owner();
+	_released.clear();
+	_released_slots.clear();
+	for (auto & retired : _retired) {
+		retired.ranges.clear();
+		retired.slots.clear();
+	}
+	changed_all();
+	publish();
+}
+
+void MyFs::set_dedup(const bool enabled) {
+	const Mutation mutation(*this);
+	std::lock_guard lock(_lock);
+	_dedup = enabled;
+	_chunks.clear();
+	if (_data == nullptr) return;
+
+	// saved with the metadata, a device mounted again keeps deduplicating
+	if (_dedup) index_chunks();
+	(*_data)["dedup"] = enabled;
+	changed();
+	flush();
+}
+
+void MyFs::index_chunks() const {
+	constexpr int CHUNK = ChunkIndex::CHUNK_SIZE;
+	std::vector<char> chunk(CHUNK);
+	for (const auto & item : (*_data)["inodes"]) {
+		if (item.contains("inline")) continue;
+		const std::vector<std::pair<int, int>> extents = extents_of(item);
+		if (extents.empty() || _slabs.owns(extents.front().first)) continue;
+
+		const int size = item.at("size");
+		for (int position = 0; position + CHUNK <= size; position += CHUNK) {
+			const auto ranges = slice(extents, position, CHUNK);
+			if (ranges.size() != 1 || ranges.front().first == HOLE) continue;
+			blkdevsim->read(ranges.front().first, CHUNK, chunk.data());
+			_chunks.insert(ChunkIndex::hash(chunk.data(), CHUNK), ranges.front().first);
+		}
+	}
+}
+
+MyFs::Usage MyFs::usage() const {
+	std::shared_lock tree(_lock);
+	std::lock_guard space(_space_lock);
+	const int capacity = BlockDeviceSimulator::DEVICE_SIZE - get_header_size();
+	const int used = capacity - _allocator.free_bytes();
+
+	// inline content takes no device space, each copy of it counts in full
+	long inlined = 0;
+	{
+		const auto pin = _epochs.pin();
+		const Version & version = *_version.load(std::memory_order_acquire);
+		version.inodes.for_each([&](std::uint64_t, const std::shared_ptr<const json> & record) {
+			if (record->contains("inline")) inlined += record->at("size").get<long>();
+		});
+	}
+	return {capacity, used, used + _refs.saved_bytes() + inlined};
+}
+
+void MyFs::upgrade_files(json &node) const {
+	if (node["type"] == "directory") {
+		for (auto& item : node["contents"].items()) {
+			upgrade_files(item.value());
+		}
+		return;
+	}
+	if (node.contains("inode")) return;
+
+	// older instances kept a single [begin, end] range in the file entry itself
+	const int begin = node["begin"];
+	const int end = node["end"];
+	const std::uint64_t number = new_inode();
+	if (begin != -1 && end >= begin) {
+		(*inode(number))["size"] = end - begin + 1;
+		(*inode(number))["extents"].push_back({begin, end - begin + 1});
+	}
+	node = {
+		{"type", "file"},
+		{"inode", number}
+	};
+}
+
+int MyFs::compact_step(const int max_bytes) {
+	int total = 0;
+	{
+		// foreground operations come first, try again later if one is running
+		std::unique_lock lock(_lock, std::try_to_lock);
+		if (!lock.owns_lock() || _data == nullptr || _transaction != nullptr || max_bytes <= 0) return 0;
+
+		// close the lowest gaps that can be closed by moving down whatever follows them. Sources are
+		// freed only after the metadata is saved, so they are left intact and never become gaps of
+		// this step: the metadata on disk stays valid until the save below replaces it
+		for (auto [gap, gap_size] = _allocator.next_free(0); gap != -1 && total < max_bytes;
+		     std::tie(gap, gap_size) = _allocator.next_free(gap + gap_size)) {
+			const int from = gap + gap_size;
+
+			if (_slabs.owns(from)) {
+				// a slab page moves as a whole, and only into a gap that holds all of it
+				if (gap_size < SlabAllocator::PAGE_SIZE || max_bytes - total < SlabAllocator::PAGE_SIZE) continue;
+				move_slab_page(from, gap);
+				total += SlabAllocator::PAGE_SIZE;
+				continue;
+			}
+
+			const auto next = _index.lower_bound(from);
+			if (next == _index.end() || next->first != from) continue;
+
+			// never move more than the gap holds
+			const int length = next->second.end - from + 1;
+			const int moved = std::min({length, gap_size, max_bytes - total});
+			move_extent(next->second.inode, from, length, gap, moved);
+			total += moved;
+		}
+		if (total == 0) return 0;
+	}
+	// one save for the whole step, shared with whatever foreground operations finish meanwhile
+	save_changes();
+	return total;
+}
+
+void MyFs::move_extent(const std::uint64_t number, const int from, const int length, const int to, const int moved) const {
+	std::vector<char> buffer(moved);
+	blkdevsim->read(from, moved, buffer.data());
+	blkdevsim->write(to, moved, buffer.data());
+
+	_released.emplace_back(from, moved);
+	_allocator.reserve(to, moved);
+	_index.erase(from);
+	_chunks.forget(from, moved);
+
+	json & record = *inode(number);
+	std::vector<std::pair<int, int>> extents;
+	for (const auto & extent : extents_of(record)) {
+		if (extent.first != from) {
+			extents.push_back(extent);
+			continue;
+		}
+
+		// join the previous extent of the file when the move makes them adjacent
+		if (!extents.empty() && extents.back().first != HOLE && extents.back().first + extents.back().second == to) {
+			extents.back().second += moved;
+			_index.set_end(extents.back().first, to + moved - 1);
+		} else {
+			extents.emplace_back(to, moved);
+			_index.insert(to, to + moved - 1, number);
+		}
+
+		// a partially moved extent keeps its tail where it was
+		if (moved < length) {
+			extents.emplace_back(from + moved, length - moved);
+			_index.insert(from + moved, from + length - 1, number);
+		}
+	}
+	record["extents"] = extents;
+	changed_inode(number);
+}
+
+void MyFs::move_slab_page(const int from, const int to) const {
+	std::vector<char> buffer(SlabAllocator::PAGE_SIZE);
+	blkdevsim->read(from, SlabAllocator::PAGE_SIZE, buffer.data());
+	blkdevsim->write(to, SlabAllocator::PAGE_SIZE, buffer.data());
+
+	_released.emplace_back(from, SlabAllocator::PAGE_SIZE);
+	_allocator.reserve(to, SlabAllocator::PAGE_SIZE);
+	_slabs.move_page(from, to);
+
+	// freed slots still waiting for readers are freed in the page's new place
+	const auto follow = [&](int & slot) {
+		if (slot >= from && slot < from + SlabAllocator::PAGE_SIZE) slot += to - from;
+	};
+	for (auto & slot : _released_slots) follow(slot);
+	for (auto & retired : _retired) {
+		for (auto & slot : retired.slots) follow(slot);
+	}
+
+	// every file with a slot in the page follows it
+	std::vector<std::pair<int, ExtentIndex::Extent>> slots(_index.lower_bound(from),
+	                                                      _index.lower_bound(from + SlabAllocator::PAGE_SIZE));
+	for (const auto & [offset, slot] : slots) {
+		const int moved_to = offset - from + to;
+		_index.erase(offset);
+		_index.insert(moved_to, slot.end - from + to, slot.inode);
+
+		json & record = *inode(slot.inode);
+		record["extents"][0][0] = moved_to;
+		changed_inode(slot.inode);
+	}
+}
+
+void MyFs::flush() const {
+	// every change made so far is in the tree, the exclusive lock holds off new ones
+	const std::uint64_t version = _changes;
+	(*_data)["slabs"] = _slabs.pages();
+	publish();
+	// a transaction's changes are saved by commit(), all at once
+	if (_write_metadata && _transaction == nullptr) _write_metadata(*_data);
+	_flushed = version;
+}
+
+void MyFs::set_metadata_writer(MetadataWriter writer) {
+	std::lock_guard lock(_lock);
+	_write_metadata = std::move(writer);
+}
+
+void MyFs::save_metadata(const MetadataWriter &write) const {
+	std::lock_guard lock(_lock);
+	if (_transaction != nullptr) {
+		write(_transaction->committed);
+		return;
+	}
+	(*_data)["slabs"] = _slabs.pages();
+	write(*_data);
+}
+
+void MyFs::begin() {
+	{
+		// another thread's transaction finishes first
+		std::unique_lock owner(_owner_lock);
+		if (_owner == std::this_thread::get_id()) throw std::runtime_error("A transaction is already in progress");
+		_owner_changed.wait(owner, [this] { return _owner == std::thread::id(); });
+		// new changes from other threads wait from here on, those running are let finish
+		_owner = std::this_thread::get_id();
+		_owner_changed.wait(owner, [this] { return _mutating == 0; });
+	}
+
+	std::lock_guard lock(_lock);
+	if (_flushed < _changes) {
+		try {
+			flush();
+		} catch (...) {
+			release_owner();
+			throw;
+		}
+	}
+
+	// a version published with the tree held shared leaves the slab pages unsaved
+	(*_data)["slabs"] = _slabs.pages();
+	_transaction = std::make_unique<Transaction>();
+	_transaction->committed = *_data;
+	_transaction->slots = slots_of(*_data);
+	// the saved tree references its ranges like a clone of every file, and like a clone's they
+	// leave the index
+	for (const auto & inode : (*_data)["inodes"]) {
+		for (const auto & [offset, length] : extents_of(inode)) {
+			if (offset == HOLE || _slabs.owns(offset)) continue;
+			_refs.share(offset, length);
+			_index.erase(offset);
+		}
+		if (inode.contains("chunks")) {
+			for (const auto & chunk : chunks_of(inode)) {
+				if (chunk.offset != HOLE) _refs.share(chunk.offset, chunk.stored);
+			}
+		}
+	}
+}
+
+void MyFs::commit() {
+	check_owner();
+	std::lock_guard lock(_lock);
+
+	// the saved tree lets go of its ranges and slots, what the new tree does not use is freed
+	drop_references(_transaction->committed);
+	const std::vector<int> & held = _transaction->released_slots;
+	_released_slots.insert(_released_slots.end(), held.begin(), held.end());
+	_transaction.reset();
+	index_extents();
+	release_owner();
+
+	// the data has to be on the device before the metadata referring to it
+	blkdevsim->sync();
+	flush();
+}
+
+void MyFs::abort() {
+	check_owner();
+	std::lock_guard lock(_lock);
+
+	// the staged tree lets go of its ranges: those it added are freed, the saved tree's have a
+	// single reference again. Of the slots, those the saved tree does not use are freed
+	drop_references(*_data);
+	std::vector<int> & held = _transaction->released_slots;
+	held.insert(held.end(), _released_slots.begin(), _released_slots.end());
+	_released_slots.clear();
+	for (const int slot : slots_of(*_data)) {
+		held.push_back(slot);
+	}
+	for (const int slot : held) {
+		if (_transaction->slots.count(slot) == 0) _released_slots.push_back(slot);
+	}
+
+	*_data = std::move(_transaction->committed);
+	_transaction.reset();
+	_handles.invalidate_all();
+	index_extents();
+
+	// the metadata on disk is the restored tree already
+	changed_all();
+	publish();
+	_flushed = _changes.load();
+	release_owner();
+}
+
+void MyFs::check_owner() const {
+	std::lock_guard owner(_owner_lock);
+	if (_owner == std::thread::id()) throw std::runtime_error("No transaction in progress");
+	if (_owner != std::this_thread::get_id()) throw std::runtime_error("The transaction belongs to another thread");
+}
+
+void MyFs::release_owner() const {
+	{
+		std::lock_guard owner(_owner_lock);
+		_owner = std::thread::id();
+	}
+	_owner_changed.notify_all();
+}
+
+MyFs::Mutation::Mutation(const MyFs &fs) : _fs(fs) {
+	std::unique_lock owner(fs._owner_lock);
+	fs._owner_changed.wait(owner, [&fs] {
+		return fs._owner == std::thread::id() || fs._owner == std::this_thread::get_id();
+	});
+	++fs._mutating;
+}
+
+MyFs::Mutation::~Mutation() {
+	{
+		std::lock_guard owner(_fs._owner_lock);
+		--_fs._mutating;
+	}
+	_fs._owner_changed.notify_all();
+}
+
+bool MyFs::in_transaction() const {
+	std::shared_lock lock(_lock);
+	return _transaction != nullptr;
+}
+
+void MyFs::index_extents() const {
+	// shared ranges stay out of the index, which only holds data a single file owns
+	_index.clear();
+	for (const auto & item : (*_data)["inodes"].items()) {
+		const std::uint64_t inode = std::stoull(item.key());
+		for (const auto & [offset, length] : extents_of(item.value())) {
+			if (offset == HOLE || !_refs.shared(offset, length).empty()) continue;
+			_index.insert(offset, offset + length - 1, inode);
+		}
+	}
+}
+
+void MyFs::drop_references(const json &tree) const {
+	for (const auto & inode : tree.at("inodes")) {
+		for (const auto & [offset, length] : extents_of(inode)) {
+			if (offset != HOLE && !_slabs.owns(offset)) release_range(offset, length);
+		}
+		if (inode.contains("chunks")) {
+			free_chunks(chunks_of(inode));
+		}
+	}
+}
+
+std::unordered_set<int> MyFs::slots_of(const json &tree) const {
+	std::unordered_set<int> slots;
+	for (const auto & inode : tree.at("inodes")) {
+		const std::vector<std::pair<int, int>> extents = extents_of(inode);
+		if (!extents.empty() && _slabs.owns(extents.front().first)) slots.insert(extents.front().first);
+	}
+	return slots;
+}
+
+void MyFs::leave_committed_slot(const std::uint64_t number, json &inode,
+                                std::vector<std::pair<int, int>> &extents) const {
+	if (_transaction == nullptr || extents.empty() || _transaction->slots.count(extents.front().first) == 0) return;
+
+	// the slot keeps the saved content, the file goes on in a copy of it
+	const auto [from, slot_size] = extents.front();
+	const int slot = [&] {
+		std::lock_guard space(_space_lock);
+		return _slabs.allocate(slot_size);
+	}();
+	if (slot == -1) throw std::runtime_error("Cannot write the file: not enough free space on the block device");
+	std::vector<char> content(slot_size);
+	blkdevsim->read(from, slot_size, content.data());
+	blkdevsim->write(slot, slot_size, content.data());
+
+	std::lock_guard space(_space_lock);
+	free_extents({extents.front()});
+	extents = {{slot, slot_size}};
+	_index.insert(slot, slot + slot_size - 1, number);
+	inode["extents"] = extents;
+}
+
+void MyFs::publish() const {
+	// readers pinning from now on see the new version, the old one waits for those still on it
+	const Version * old = _version.load(std::memory_order_relaxed);
+	_version.store(next_version(old).release(), std::memory_order_release);
+	if (_transaction != nullptr) {
+		// a freed slot may be the saved tree's, it is held until the transaction ends
+		std::vector<int> & held = _transaction->released_slots;
+		held.insert(held.end(), _released_slots.begin(), _released_slots.end());
+		_released_slots.clear();
+	}
+	_retired.push_back({_epochs.advance(), std::unique_ptr<const Version>(old), std::move(_released),
+	                    std::move(_released_slots)});
+	_released.clear();
+	_released_slots.clear();
+	reclaim();
+}
+
+void MyFs::publish_shared() const {
+	std::lock_guard publishing(_publish_lock);
+	// the marks are taken after the count, so every change counted is in the new version
+	const std::uint64_t version = _changes;
+	const Version * old = _version.load(std::memory_order_relaxed);
+	_version.store(next_version(old).release(), std::memory_order_release);
+
+	std::lock_guard space(_space_lock);
+	_retired.push_back({_epochs.advance(), std::unique_ptr<const Version>(old), {}, {}});
+	reclaim();
+	if (_flushed < version) _flushed = version;
+}
+
+std::unique_ptr<MyFs::Version> MyFs::next_version(const Version *old) const {
+	std::unordered_set<std::uint64_t> inodes;
+	std::set<std::vector<std::string>> directories;
+	bool all;
+	{
+		std::lock_guard dirty(_dirty_lock);
+		inodes.swap(_dirty_inodes);
+		directories.swap(_dirty_directories);
+		all = _dirty_all;
+		_dirty_all = false;
+	}
+
+	auto version = std::make_unique<Version>();
+	if (old == nullptr || all) {
+		{
+			std::shared_lock table(_inodes_lock);
+			for (const auto & item : _data->at("inodes").items()) {
+				const std::uint64_t number = std::stoull(item.key());
+				std::shared_lock file(inode_lock(number));
+				version->inodes = version->inodes.insert(number, std::make_shared<const json>(item.value()));
+			}
+		}
+		version->root = read_directory(_data->at("/"), nullptr, *version);
+		return version;
+	}
+
+	*version = *old;
+	{
+		std::shared_lock table(_inodes_lock);
+		for (const std::uint64_t number : inodes) {
+			copy_record(*version, number);
+		}
+	}
+
+	// the deepest directories first, a parent rebuilt after them shares their new entries.
+	// Directories only move under the exclusive lock, which flushes, so the names recorded
+	// since the last version still lead where they did
+	std::vector<std::vector<std::string>> order(directories.begin(), directories.end());
+	std::stable_sort(order.begin(), order.end(), [](const auto & a, const auto & b) {
+		return a.size() > b.size();
+	});
+	for (const auto & names : order) {
+		const json * directory = &_data->at("/");
+		const ReadDirectory * previous = version->root.get();
+		for (const auto & name : names) {
+			std::shared_lock entries(directory_lock(*directory));
+			const auto contents = directory->find("contents");
+			const auto entry = contents == directory->end() ? directory->end() : contents->find(name);
+			// a directory removed since, its parent is rebuilt without it
+			if (contents == directory->end() || entry == contents->end()) {
+				directory = nullptr;
+				break;
+			}
+			directory = &*entry;
+			const ReadEntry * seen = previous == nullptr ? nullptr : previous->entries.find(name);
+			previous = seen == nullptr ? nullptr : seen->directory.get();
+		}
+		if (directory == nullptr || directory->at("type") != "directory") continue;
+		version->root = with_directory(version->root, names, 0, read_directory(*directory, previous, *version));
+	}
+	return version;
+}
+
+void MyFs::copy_record(Version &version, const std::uint64_t number) const {
+	const json & records = _data->at("inodes");
+	const auto record = records.find(std::to_string(number));
+	if (record == records.end()) {
+		// removed after the marks were taken, the directory it was in may still list it: both
+		// leave the version together, with the remove's own marks
+		std::lock_guard dirty(_dirty_lock);
+		if (_dirty_inodes.count(number) == 0) version.inodes = version.inodes.erase(number);
+		return;
+	}
+	std::shared_lock file(inode_lock(number));
+	version.inodes = version.inodes.insert(number, std::make_shared<const json>(*record));
+}
+
+std::shared_ptr<const MyFs::ReadDirectory> MyFs::read_directory(const json &directory, const ReadDirectory *previous,
+                                                                Version &version) const {
+	PersistentMap<std::string, ReadEntry> entries;
+	std::vector<std::pair<std::string, const json *>> added;
+	{
+		std::shared_lock lock(directory_lock(directory));
+		std::vector<std::uint64_t> unseen;
+		for (const auto & item : directory.at("contents").items()) {
+			if (item.value().at("type") == "file") {
+				const std::uint64_t number = item.value().at("inode");
+				entries = entries.insert(item.key(), {number, nullptr});
+				if (version.inodes.find(number) == nullptr) unseen.push_back(number);
+				continue;
+			}
+			// a subdirectory that changed was rebuilt into previous already, or is new and read
+			// whole once this one is let go
+			const ReadEntry * seen = previous == nullptr ? nullptr : previous->entries.find(item.key());
+			if (seen != nullptr && seen->directory != nullptr) {
+				entries = entries.insert(item.key(), {0, seen->directory});
+			} else {
+				added.emplace_back(item.key(), &item.value());
+			}
+		}
+
+		// a file created after the marks were taken has an entry here, its record goes with it
+		if (!unseen.empty()) {
+			std::shared_lock table(_inodes_lock);
+			for (const std::uint64_t number : unseen) {
+				copy_record(version, number);
+			}
+		}
+	}
+	for (const auto & [name, subdirectory] : added) {
+		entries = entries.insert(name, {0, read_directory(*subdirectory, nullptr, version)});
+	}
+	return std::make_shared<const ReadDirectory>(ReadDirectory{std::move(entries)});
+}
+
+std::shared_ptr<const MyFs::ReadDirectory> MyFs::with_directory(const std::shared_ptr<const ReadDirectory> &root,
+                                                                const std::vector<std::string> &names,
+                                                                const std::size_t depth,
+                                                                std::shared_ptr<const ReadDirectory> directory) {
+	if (depth == names.size()) return directory;
+
+	// a directory new since the last version is read whole with its parent
+	const ReadEntry * entry = root->entries.find(names[depth]);
+	if (entry == nullptr || entry->directory == nullptr) return root;
+	ReadEntry replaced{0, with_directory(entry->directory, names, depth + 1, std::move(directory))};
+	return std::make_shared<const ReadDirectory>(ReadDirectory{root->entries.insert(names[depth], std::move(replaced))});
+}
+
+MyFs::Found MyFs::find_in(const Version &version, const std::vector<std::string> &tokens) {
+	// raw pointers only, readers touch no reference count
+	Found found{version.root.get(), 0};
+	for (const auto & token : tokens) {
+		if (token.empty()) continue; // Skip empty tokens (could happen with leading '/')
+		const ReadEntry * entry = found.directory == nullptr ? nullptr : found.directory->entries.find(token);
+		if (entry == nullptr) throw std::runtime_error("File or directory not found");
+		found = {entry->directory.get(), entry->inode};
+	}
+	return found;
+}
+
+const json &MyFs::inode_in(const Version &version, const std::uint64_t number) {
+	const std::shared_ptr<const json> * record = version.inodes.find(number);
+	if (record == nullptr) throw std::runtime_error("File or directory not found");
+	return **record;
+}
+
+void MyFs::changed_inode(const std::uint64_t number) const {
+	{
+		std::lock_guard dirty(_dirty_lock);
+		_dirty_inodes.insert(number);
+	}
+	changed();
+}
+
+void MyFs::changed_entries(std::vector<std::string> names) const {
+	{
+		std::lock_guard dirty(_dirty_lock);
+		_dirty_directories.insert(std::move(names));
+	}
+	changed();
+}
+
+void MyFs::changed_entries(const std::vector<std::vector<std::string>> &directories,
+                           const std::vector<std::uint64_t> &inodes) const {
+	{
+		std::lock_guard dirty(_dirty_lock);
+		_dirty_directories.insert(directories.begin(), directories.end());
+		_dirty_inodes.insert(inodes.begin(), inodes.end());
+	}
+	changed();
+}
+
+void MyFs::changed_all() const {
+	std::lock_guard dirty(_dirty_lock);
+	_dirty_all = true;
+}
+
+void MyFs::reclaim() const {
+	// versions are retired in epoch order, so the first one still held stops the scan
+	while (!_retired.empty() && _epochs.quiescent(_retired.front().epoch)) {
+		Retired & retired = _retired.front();
+		for (const int slot : retired.slots) {
+			_slabs.release(slot);
+		}
+		_allocator.release_all(std::move(retired.ranges));
+		_retired.pop_front();
+	}
+}
+
+void MyFs::save_changes() const {
+	const std::uint64_t version = _changes;
+	if (_flushed >= version && !space_released()) return;
+
+	{
+		// with no metadata to write, the version is built with the tree lock held shared and
+		// operations in other directories go on meanwhile. Freed space waits for an exclusive
+		// flush: only once no operation is halfway is every version referring to it retired
+		std::shared_lock tree(_lock);
+		if (_flushed >= version && !space_released()) return;
+		if ((!_write_metadata || _transaction != nullptr) && !space_released()) {
+			publish_shared();
+			return;
+		}
+	}
+
+	// the exclusive lock waits for the operations in progress, one flush then saves them all
+	std::lock_guard lock(_lock);
+	if (_flushed >= version && !space_released()) return;
+	flush();
+}
+
+bool MyFs::space_released() const {
+	std::lock_guard space(_space_lock);
+	return !_released.empty() || !_released_slots.empty();
+}
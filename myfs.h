@@ -1,14 +1,52 @@
 #ifndef MYFS_H_
 #define MYFS_H_
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
 #include <vector>
+#include "allocator.h"
 #include "blkdev.h"
+#include "chunk_index.h"
+#include "compressor.h"
+#include "defragmenter.h"
+#include "epoch_manager.h"
+#include "extent_index.h"
+#include "handle_table.h"
 #include "json.hpp"
+#include "lock_table.h"
+#include "persistent_map.h"
+#include "ref_counts.h"
+#include "rw_lock.h"
+#include "slab_allocator.h"
 
 using json = nlohmann::json;
 
 class MyFs {
 public:
+	// where seek() counts its offset from
+	enum class Whence {
+		SET,     // the beginning of the file
+		CURRENT, // the current position
+		END      // the end of the file
+	};
+
+	// how much of the block device the files use, see usage()
+	struct Usage {
+		int capacity;    // bytes of the device available for files
+		int used;        // bytes allocated, slab pages and preallocated capacity included
+		long referenced; // bytes the files refer to, a shared byte counted once per reference and
+		                 // inline content included
+	};
+
 	explicit MyFs(BlockDeviceSimulator *blkdevsim_);
 
 	/**
@@ -33,6 +71,8 @@ public:
 	 * directory.
 	 * @param path_str the file path (e.g. "/somefile")
 	 * @return the content of the file
+	 * @note Reads take no lock. They see the metadata as it was last saved, and may see part of a
+	 *       write to the same bytes that runs at the same time.
 	 */
 	[[nodiscard]] std::string get_content(const std::string& path_str) const;
 
@@ -42,9 +82,218 @@ public:
 	 * Note: this method assumes path_str refers to a file and not a
 	 * directory.
 	 * @param path_str the file path (e.g. "/somefile")
+	 *
+	 * @note The line read from std::cin is written to the device before the file's old content is
+	 *       let go, and the metadata is saved once at the end. If it does not fit, the rest of the
+	 *       line is still read and the file keeps its old content.
 	 */
 	void set_content(const std::string& path_str) const;
 
+	/**
+	 * @brief Replaces the whole content of a file. Every byte is kept, NULs and newlines included.
+	 *
+	 * @param path_str The file path (e.g. "/somefile").
+	 * @param bytes The new content.
+	 *
+	 * @throws std::runtime_error If the path does not refer to a file or the device is full.
+	 */
+	void set_content(const std::string& path_str, std::string_view bytes) const;
+
+	/**
+	 * @brief Appends bytes to the end of a file.
+	 *
+	 * @param path_str The file path (e.g. "/somefile").
+	 * @param bytes The bytes to append.
+	 *
+	 * @throws std::runtime_error If the path does not refer to a file or the device is full.
+	 *
+	 * @note Only the appended bytes are written: they go into the free space left in the file's
+	 *       last extent or slot, then into the bytes right after it, and otherwise into a new
+	 *       extent. Files that are stored inline or whose slot is too small are moved first, which
+	 *       costs at most a slab slot.
+	 */
+	void append(const std::string& path_str, std::string_view bytes) const;
+
+	/**
+	 * @brief Reads a byte range of a file.
+	 *
+	 * @param path_str The file path (e.g. "/somefile").
+	 * @param offset The first byte to read.
+	 * @param length The number of bytes to read.
+	 *
+	 * @return The bytes read, fewer than length when the range goes past the end of the file.
+	 *
+	 * @throws std::runtime_error If the path does not refer to a file or the range is negative.
+	 *
+	 * @note Reads take no lock. They see the metadata as it was last saved, and may see part of a
+	 *       write to the same bytes that runs at the same time.
+	 */
+	[[nodiscard]] std::string read_at(const std::string& path_str, int offset, int length) const;
+
+	/**
+	 * @brief Reads a byte range of a file into a caller-provided buffer.
+	 *
+	 * @return The number of bytes copied into buffer, fewer than length when the range goes past
+	 *         the end of the file.
+	 *
+	 * @throws std::runtime_error If the path does not refer to a file or the range is negative.
+	 */
+	int read_at(const std::string& path_str, int offset, char* buffer, int length) const;
+
+	/**
+	 * @brief Writes bytes at a given offset of a file, extending it when needed.
+	 *
+	 * @param path_str The file path (e.g. "/somefile").
+	 * @param offset The first byte to write. Bytes between the end of the file and offset read as
+	 *               zeros afterwards; past the file's capacity they are left as a hole that uses no
+	 *               device space.
+	 * @param bytes The bytes to write.
+	 *
+	 * @throws std::runtime_error If the path does not refer to a file or the device is full.
+	 *
+	 * @note Bytes inside the current size are overwritten on the device directly, extensions get
+	 *       their space from the allocator as in append(). The cost is proportional to the bytes
+	 *       written.
+	 */
+	void write_at(const std::string& path_str, int offset, std::string_view bytes) const;
+
+	/**
+	 * @brief Reserves device space for a file that will grow to a known size.
+	 *
+	 * The file's size does not change. Holes in the first size bytes are filled with zeros and the
+	 * capacity is extended to size, in a single extent when the device has one large enough, so
+	 * later writes up to size are done in place without allocating or moving data.
+	 *
+	 * @param path_str The file path (e.g. "/somefile").
+	 * @param size The number of bytes to reserve space for.
+	 *
+	 * @throws std::runtime_error If the path does not refer to a file or the device is full.
+	 */
+	void preallocate(const std::string& path_str, int size) const;
+
+	/**
+	 * @brief Changes the size of a file without rewriting its content.
+	 *
+	 * Shrinking frees the device space past the new size, including any preallocated capacity.
+	 * Growing makes the new bytes read as zeros: capacity the file already has is cleared, the
+	 * rest becomes a hole that uses no device space. Other files are never moved.
+	 *
+	 * @param path_str The file path (e.g. "/somefile").
+	 * @param new_size The new size in bytes.
+	 *
+	 * @throws std::runtime_error If the path does not refer to a file or new_size is negative.
+	 */
+	void truncate(const std::string& path_str, int new_size) const;
+
+	/**
+	 * @brief Creates a copy of a file that shares the source's device space.
+	 *
+	 * No data is copied: both files refer to the same extents, with reference counts, until one
+	 * of them writes. A write then gets private space for the bytes it covers only, so near-
+	 * identical files use space just for their differences. Files small enough for the inline or
+	 * slab storage are copied outright.
+	 *
+	 * @param src_path The file to clone (e.g. "/somefile").
+	 * @param dst_path The path of the new file, which must not exist.
+	 *
+	 * @throws std::runtime_error If src_path does not refer to a file, or dst_path exists or its
+	 *                            parent is not a directory.
+	 */
+	void clone(const std::string& src_path, const std::string& dst_path) const;
+
+	/**
+	 * @brief Moves a file or directory to a new path, possibly in another directory.
+	 *
+	 * Only the directory entry is relinked: the inode, its data and any open descriptors are
+	 * unaffected, and the change is saved in a single metadata update.
+	 *
+	 * @param old_path The file or directory to move (e.g. "/dir/somefile").
+	 * @param new_path Its new path. The parent directory must exist.
+	 * @param replace Whether an existing file at new_path is replaced. The replaced file is
+	 *                removed in the same update, so new_path always refers to one of the two files.
+	 *
+	 * @throws std::runtime_error If old_path does not exist or is the root, new_path exists and
+	 *                            replace is not set or it is not a file replaced by a file, or a
+	 *                            directory would be moved into itself.
+	 */
+	void rename(const std::string& old_path, const std::string& new_path, bool replace = false) const;
+
+	/**
+	 * @brief Turns compression on or off for a file, or for a directory and everything below it.
+	 *
+	 * A compressed file is stored in independent chunks of COMPRESSED_CHUNK_SIZE bytes, each
+	 * packed by the Compressor and listed in a chunk table in the inode. Reads decompress only the
+	 * chunks they touch and writes repack only the chunks they change; chunks of zeros take no
+	 * device space. A directory keeps the setting, and files and directories created in it later
+	 * inherit it. The data is converted right away.
+	 *
+	 * @param path_str The file or directory path (e.g. "/somedir").
+	 * @param enabled Whether the data is compressed.
+	 *
+	 * @throws std::runtime_error If the path does not exist or the device is too full to convert a
+	 *                            file, the files converted before that one stay converted.
+	 */
+	void set_compression(const std::string& path_str, bool enabled) const;
+
+	/**
+	 * @brief Opens a file and binds a descriptor to it.
+	 *
+	 * The path is resolved once; reads and writes through the descriptor go straight to the
+	 * file's inode. The descriptor starts at position 0 and stays valid if the file is renamed,
+	 * but becomes stale once the file is removed.
+	 *
+	 * @param path_str The file path (e.g. "/somefile").
+	 * @param truncate Whether the file is emptied first.
+	 *
+	 * @return A small integer descriptor.
+	 *
+	 * @throws std::runtime_error If the path does not refer to a file or too many files are open.
+	 */
+	int open(const std::string& path_str, bool truncate = false) const;
+
+	/**
+	 * @brief Reads from the descriptor's position and moves the position past the bytes read.
+	 *
+	 * @return The bytes read, fewer than length at the end of the file.
+	 *
+	 * @throws std::runtime_error If the descriptor is closed or stale.
+	 */
+	[[nodiscard]] std::string read(int fd, int length) const;
+
+	/**
+	 * @brief Reads from the descriptor's position into a caller-provided buffer and moves the
+	 * position past the bytes read.
+	 *
+	 * @return The number of bytes copied into buffer, 0 at the end of the file.
+	 *
+	 * @throws std::runtime_error If the descriptor is closed or stale.
+	 */
+	int read(int fd, char* buffer, int length) const;
+
+	/**
+	 * @brief Writes at the descriptor's position and moves the position past the bytes written.
+	 *
+	 * @throws std::runtime_error If the descriptor is closed or stale, or the device is full.
+	 */
+	void write(int fd, std::string_view bytes) const;
+
+	/**
+	 * @brief Moves the descriptor's position. The position may go past the end of the file.
+	 *
+	 * @return The new position.
+	 *
+	 * @throws std::runtime_error If the descriptor is closed or stale, or the position would be
+	 *                            negative.
+	 */
+	int seek(int fd, int offset, Whence whence = Whence::SET) const;
+
+	/**
+	 * @brief Releases a descriptor.
+	 *
+	 * @throws std::runtime_error If the descriptor is closed or stale.
+	 */
+	void close(int fd) const;
+
    /**
 	 * list_dir method
 	 * Returns a list of a files in a directory.
@@ -52,6 +301,7 @@ public:
 	 * file.
 	 * @param path_str the file path (e.g. "/somedir")
 	 * @return a vector (you need to change the return type in the function declaration)
+	 * @note Takes no lock, like get_content().
 	 */
 	void list_dir(const std::string &path_str) const;
 
@@ -93,18 +343,125 @@ public:
 	 *       If the directory does not exist, or if the path_str is not a valid directory path,
 	 *       an exception will be thrown.
 	 *
-	 * @note This method does not remove the directory if it is not empty. It will throw an
-	 *       exception in such cases.
+	 * @note The whole subtree is removed in one pass: all of its extents are released to the
+	 *       allocator in offset order and the metadata is saved once.
 	 */
 	void remove_dir(const std::string& path_str);
 
-	void recursive_delete(json * current, const std::string& path_str, std::vector<std::string> & paths);
+	/**
+	 * @brief Collects the inode numbers of every file under a directory, at any depth.
+	 *
+	 * @param current The json node of the directory.
+	 * @param inodes The vector the inode numbers are appended to.
+	 */
+	static void recursive_delete(const json * current, std::vector<std::uint64_t> & inodes);
+
 
+	/**
+	 * @brief Attaches the metadata tree and rebuilds the free space map from the files it holds.
+	 *
+	 * @param data The json metadata, it must outlive this object.
+	 */
+	void set_json_data(json & data);
 
-	void set_json_data(json & data) {
-		_data = &data;
+	/**
+	 * Saves the metadata tree somewhere, see set_metadata_writer(). Called with the filesystem held
+	 * exclusively.
+	 */
+	using MetadataWriter = std::function<void(const json & metadata)>;
+
+	/**
+	 * @brief Chooses what saves the metadata after each change. Without a writer the metadata only
+	 *        lives in memory until save_metadata() is called.
+	 */
+	void set_metadata_writer(MetadataWriter writer);
+
+	/**
+	 * @brief Hands the current metadata to write, once every operation in progress is done.
+	 */
+	void save_metadata(const MetadataWriter & write) const;
+
+	/**
+	 * @brief Starts a transaction owned by the calling thread: the changes it makes from now on are
+	 *        applied as a whole by commit() or not at all.
+	 *
+	 * Until then the metadata is not saved and nothing the saved metadata refers to is
+	 * overwritten or reused: writes go to new space, so a process that stops part way leaves the
+	 * filesystem as it was at begin(). Operations see the changes staged before them. The
+	 * defragmenter pauses for the length of the transaction.
+	 *
+	 * Transactions are serialized: operations that change the filesystem from other threads wait
+	 * until the owner commits or aborts, so they never land in a transaction they did not open
+	 * and are never dropped by its abort(). begin() from another thread waits the same way, and
+	 * for the changes already running to finish. Reads are not held back and are not isolated:
+	 * other threads see the changes staged so far.
+	 *
+	 * @note The owner must not wait for changes it hands to other threads (an AsyncMyFs, for one)
+	 *       before it commits or aborts, they wait for it.
+	 *
+	 * @throws std::runtime_error If the calling thread already has a transaction in progress.
+	 */
+	void begin();
+
+	/**
+	 * @brief Applies the transaction: the data written in it reaches the device, then the
+	 *        metadata is saved once.
+	 *
+	 * @throws std::runtime_error If the calling thread has no transaction in progress.
+	 */
+	void commit();
+
+	/**
+	 * @brief Drops every change made since begin() and frees the space the transaction used.
+	 *
+	 * @note Descriptors returned by open() are closed, as they may refer to dropped files.
+	 *
+	 * @throws std::runtime_error If the calling thread has no transaction in progress.
+	 */
+	void abort();
+
+	/**
+	 * @return true between begin() and commit() or abort().
+	 */
+	bool in_transaction() const;
+
+	/**
+	 * @brief Chooses how free extents are picked when a file needs new space.
+	 */
+	void set_alloc_policy(SpaceAllocator::Policy policy) {
+		std::lock_guard lock(_space_lock);
+		_allocator.set_policy(policy);
 	}
 
+	/**
+	 * @brief Sets the largest file size kept inline in the inode record instead of on the device.
+	 *
+	 * @param bytes The threshold in bytes, 0 stores every file on the device. Files are moved in or
+	 *              out of their inode the next time their content is set.
+	 */
+	void set_inline_threshold(int bytes) {
+		std::lock_guard lock(_lock);
+		_inline_threshold = bytes;
+	}
+
+	/**
+	 * @brief Turns inline deduplication of file content on or off.
+	 *
+	 * While it is on, files stored in general extents are written in ChunkIndex::CHUNK_SIZE chunks
+	 * at fixed file offsets. A chunk whose bytes are already stored on the device is not written:
+	 * the file refers to the stored copy, which is reference counted like a clone's. Turning it on
+	 * indexes the chunks already on the device, which reads every large file once. The setting is
+	 * saved with the metadata; set before the metadata is loaded, it applies unless the metadata
+	 * has one of its own.
+	 */
+	void set_dedup(bool enabled);
+
+	/**
+	 * @return How much of the block device is allocated and how much file data it holds. The ratio
+	 *         of referenced to used bytes is what deduplication and clones save.
+	 */
+	[[nodiscard]] Usage usage() const;
+
 	/**
 	 * This function returns the size of the 'myfs_header' struct in bytes.
 	 * The 'myfs_header' struct represents the first bytes of a myfs filesystem.
@@ -119,10 +476,34 @@ public:
 		return sizeof(myfs_header);
 	}
 
-	~MyFs() {
-		// this was added, because blkdevsim was allocated on the heap
-		delete blkdevsim;
-	}
+	/**
+	 * @brief Starts compacting the block device on a background thread.
+	 *
+	 * @param config The I/O budget of the defragmenter.
+	 */
+	void start_defragmenter(const Defragmenter::Config & config = {});
+
+	/**
+	 * @brief Stops the background defragmenter, if it is running.
+	 */
+	void stop_defragmenter();
+
+	/**
+	 * @brief Closes the lowest gaps on the block device by moving the extents following them down,
+	 *        until max_bytes were moved or nothing more can move.
+	 *
+	 * @param max_bytes The largest number of bytes this step may move.
+	 *
+	 * @return The number of bytes moved, 0 when the device is already compact or when another
+	 *         operation holds the filesystem.
+	 *
+	 * @note The step never waits for the filesystem, it is meant to be called by the defragmenter.
+	 *       The metadata is saved once per step, after the filesystem is let go. Nothing moves
+	 *       during a transaction.
+	 */
+	int compact_step(int max_bytes);
+
+	~MyFs();
 
 
 private:
@@ -140,6 +521,27 @@ private:
 		uint8_t version;
 	};
 
+	// what readers see of the tree: a version that never changes once published. Versions share
+	// every directory and inode record that did not change between them, see publish().
+	struct ReadDirectory;
+	struct ReadEntry {
+		std::uint64_t inode;                            // a file's inode number
+		std::shared_ptr<const ReadDirectory> directory; // a directory's entries, null for a file
+	};
+	struct ReadDirectory {
+		PersistentMap<std::string, ReadEntry> entries;
+	};
+	struct Version {
+		std::shared_ptr<const ReadDirectory> root;
+		PersistentMap<std::uint64_t, std::shared_ptr<const json>> inodes;
+	};
+
+	// what a path leads to in a version
+	struct Found {
+		const ReadDirectory * directory; // null for a file
+		std::uint64_t inode;             // a file's inode number
+	};
+
 	/**
 	* @brief Traverses the JSON structure to find the specified file or directory.
 	 *
@@ -160,6 +562,7 @@ private:
 	 * std::runtime_error is thrown.
 	 */
 	static json * traverse(json * current, const std::vector<std::string> & tokens);
+	static const json * traverse(const json * current, const std::vector<std::string> & tokens);
 
 	/**
 	 * @brief Builds a path vector to traverse the JSON structure.
@@ -176,6 +579,67 @@ private:
 	 */
 	static json * get_parent(json * current, const std::vector<std::string> & tokens);
 
+	/**
+	 * @return The components of a path, without the empty ones a leading or doubled '/' makes.
+	 */
+	static std::vector<std::string> names_of(const std::string & path_str);
+
+	/**
+	 * @return The entry with the given name in a directory, or null if there is none or directory
+	 *         is a file.
+	 */
+	static json * find_entry(json & directory, const std::string & name);
+
+	/**
+	 * @brief Finds the directory holding the last component of a path, for callers holding the tree
+	 *        lock shared.
+	 *
+	 * Each directory on the way is locked shared only while it is searched, and the one returned
+	 * is not locked. It stays valid anyway: directories are only removed or moved with the tree
+	 * lock held exclusively.
+	 *
+	 * @param names The path components, at least one.
+	 *
+	 * @return The parent directory, or a file if the path goes through one.
+	 *
+	 * @throws std::runtime_error If a directory on the way does not exist.
+	 */
+	json * parent_of(const std::vector<std::string> & names) const;
+
+	/**
+	 * @brief Resolves a path to a file and locks the inode table, so the file's inode stays while the
+	 *        caller uses it even if the file is removed meanwhile.
+	 *
+	 * @param inodes A std::shared_lock or std::unique_lock, which decides how the table is locked.
+	 *
+	 * @return The inode number of the file.
+	 *
+	 * @throws std::runtime_error If the path does not exist or does not refer to a file.
+	 */
+	template <typename Lock>
+	std::uint64_t file_of(const std::string & path_str, Lock & inodes) const;
+
+	/**
+	 * @brief Moves an entry from one directory to another, see rename(), and records the change.
+	 *        Both directories must be locked.
+	 */
+	void relink(json & old_parent, const std::vector<std::string> & old_names, json & new_parent,
+	            const std::vector<std::string> & new_names, bool replace) const;
+
+	/**
+	 * @return The lock guarding a directory's entries.
+	 */
+	RwLock & directory_lock(const json & directory) const {
+		return _dir_locks.of(reinterpret_cast<std::uintptr_t>(&directory));
+	}
+
+	/**
+	 * @return The lock guarding an inode's record and content.
+	 */
+	RwLock & inode_lock(std::uint64_t number) const {
+		return _inode_locks.of(number);
+	}
+
 	/**
 	 * @brief Builds a JSON object representing a file or directory structure.
 	 *
@@ -189,50 +653,531 @@ private:
 	 *          If the size of the `tokens` vector is greater than 1, it creates the item under the `from_root` directory.
 	 *          If the `directory` parameter is true, it creates a directory; otherwise, it creates a file.
 	 *          The function sets the "type" field to "directory" or "file", and initializes the "contents" field for directories.
-	 *          For files, it sets the "begin" and "end" fields to -1, indicating that the file content is not yet allocated.
+	 *          For files, it sets the "inode" field to the inode holding the file's size and extents.
+	 *
+	 * @param inode The inode number of the new file, ignored for directories.
 	 *
 	 * @return void
 	 */
-	static void build_json(const std::vector<std::string>& tokens, bool directory, json * from_root, json * current);
+	static void build_json(const std::vector<std::string>& tokens, bool directory, json * from_root, json * current,
+	                       std::uint64_t inode);
+
+	/**
+	 * @return The inode record with the given number.
+	 */
+	json * inode(std::uint64_t number) const;
+
+	/**
+	 * @return The inode record of the given file entry.
+	 */
+	json * inode_of(const json & file) const;
 
 	/**
-	 * Resizes the block device based on the edited file content.
+	 * @return true if node lies anywhere below directory.
+	 */
+	static bool contains(const json & directory, const json & node);
+
+	/**
+	 * @brief Creates an empty inode record.
+	 *
+	 * @return The number of the new inode.
+	 */
+	std::uint64_t new_inode() const;
+
+	/**
+	 * @return The (offset, size) extents of an inode, in file order. Holes have offset HOLE.
+	 */
+	static std::vector<std::pair<int, int>> extents_of(const json & inode);
+
+	/**
+	 * @return The extents holding the first size bytes of an inode, the last one cut to fit.
+	 *         Extents may be larger than the data they hold, e.g. slab slots.
+	 */
+	static std::vector<std::pair<int, int>> extents_of(const json & inode, int size);
+
+	/**
+	 * @return The device ranges holding bytes [offset, offset + length) of a file with the given
+	 *         extents. Ranges that fall in a hole keep offset HOLE.
+	 */
+	static std::vector<std::pair<int, int>> slice(const std::vector<std::pair<int, int>> & extents, int offset,
+	                                              int length);
+
+	// a chunk of a compressed file: device range and decompressed size, HOLE when it is all zeros
+	struct Chunk {
+		int offset;
+		int stored; // bytes on the device, equal to length when the chunk did not compress
+		int length; // bytes it holds, the chunk reads as zeros past them
+	};
+
+	/**
+	 * @return The chunk table of a compressed file.
+	 */
+	static std::vector<Chunk> chunks_of(const json & inode);
+
+	/**
+	 * @brief Stores a chunk table in a compressed file's inode.
+	 */
+	static void set_chunks(json & inode, const std::vector<Chunk> & chunks);
+
+	/**
+	 * @brief Decompresses a chunk into COMPRESSED_CHUNK_SIZE bytes of out.
+	 *
+	 * @throws std::runtime_error If the stored chunk is corrupt.
+	 */
+	void read_chunk(const Chunk & chunk, char * out) const;
+
+	/**
+	 * @brief Compresses size bytes into new chunks on the device.
+	 *
+	 * @throws std::runtime_error If the device does not have enough free space, nothing is
+	 *                            allocated then.
+	 */
+	std::vector<Chunk> store_chunks(const char * buffer, int size) const;
+
+	/**
+	 * @brief Frees chunks, except the parts that clones still refer to.
+	 */
+	void free_chunks(const std::vector<Chunk> & chunks) const;
+
+	/**
+	 * @brief Writes bytes at a given offset of a compressed file, repacking the chunks they touch.
+	 */
+	void write_compressed(json & inode, int offset, const char * buffer, int size) const;
+
+	/**
+	 * @brief Changes the size of a compressed file, see truncate().
+	 */
+	void truncate_compressed(json & inode, int new_size) const;
+
+	/**
+	 * @brief Converts a file to or from compressed chunks, a no-op when it already is.
+	 */
+	void convert(std::uint64_t number, json & inode, bool compressed) const;
+
+	/**
+	 * @brief Converts every file below a directory and sets the directory's compression flag.
+	 */
+	void convert_tree(json & directory, bool compressed) const;
+
+	/**
+	 * @brief Reads bytes [offset, offset + length) of a file, which must lie within its size.
+	 */
+	void read_inode(const json & inode, int offset, int length, char * buffer) const;
+
+	/**
+	 * @brief Adds missing bytes of device space at the end of a file's extents.
+	 *
+	 * @details The last extent is grown in place when the bytes after it are free, otherwise new
+	 *          extents are taken wherever the allocator finds space.
 	 *
-	 * @param current A pointer to the JSON object representing the file to be edited.
-	 * @param content The new content for the file.
+	 * @throws std::runtime_error If the device does not have enough free space.
+	 */
+	void add_capacity(std::uint64_t number, std::vector<std::pair<int, int>> & extents, int missing) const;
+
+	/**
+	 * @brief Frees the extents, or parts of extents, past the first size bytes of a file.
+	 */
+	void release_tail(std::vector<std::pair<int, int>> & extents, int size) const;
+
+	/**
+	 * @brief Frees a general device range, except the parts that clones still refer to.
+	 */
+	void release_range(int offset, int length) const;
+
+	/**
+	 * @brief Splits bytes [offset, offset + length) of a file into holes, private ranges and
+	 *        ranges shared with clones.
+	 *
+	 * @param shared Set to whether each returned piece is shared.
+	 *
+	 * @return The pieces in file order, holes with offset HOLE.
+	 */
+	std::vector<std::pair<int, int>> pieces(const std::vector<std::pair<int, int>> & extents, int offset, int length,
+	                                        std::vector<bool> & shared) const;
+
+	/**
+	 * @brief Replaces the extents covering bytes [offset, offset + length) of a file, which must lie
+	 *        within its capacity, by replacement. The extents at either end are split, so they
+	 *        must not be in the index.
+	 */
+	static void splice(std::vector<std::pair<int, int>> & extents, int offset, int length,
+	                   const std::vector<std::pair<int, int>> & replacement);
+
+	/**
+	 * @brief Makes bytes [offset, offset + length) of a file read as zeros. Private bytes are
+	 *        zeroed, bytes shared with clones become a hole and holes stay as they are.
+	 */
+	void clear_range(std::vector<std::pair<int, int>> & extents, int offset, int length) const;
+
+	/**
+	 * @brief Gives a file private device space for bytes [offset, offset + length).
+	 *
+	 * Holes and ranges shared with clones are replaced by newly allocated ranges, the file's
+	 * private ranges are kept.
+	 *
+	 * @param keep_content Whether the new ranges get the bytes they replace, zeros for holes.
+	 *                     Without it the caller must overwrite the whole range.
+	 *
+	 * @throws std::runtime_error If the device does not have enough free space, nothing is
+	 *                            allocated then.
+	 */
+	void own_range(std::uint64_t number, std::vector<std::pair<int, int>> & extents, int offset, int length,
+	               bool keep_content) const;
+
+	/**
+	 * @brief Writes bytes [offset, offset + length) of a file stored in general extents, which must
+	 *        lie within its capacity.
+	 *
+	 * Holes and ranges shared with clones get private space first. With deduplication on, every
+	 * whole chunk that is already stored elsewhere becomes a reference to that copy instead.
+	 *
+	 * @throws std::runtime_error If the device does not have enough free space. With deduplication
+	 *                            on, the chunks before the failing one are stored by then.
+	 */
+	void write_range(std::uint64_t number, std::vector<std::pair<int, int>> & extents, int offset, const char * buffer,
+	                 int length) const;
+
+	/**
+	 * @brief Indexes every whole chunk of the files stored in general extents that lies in a single
+	 *        device range.
+	 */
+	void index_chunks() const;
+
+	/**
+	 * @brief Moves an inline or slab-slot file into general extents.
+	 */
+	void unpack(std::uint64_t number, json & inode, std::vector<std::pair<int, int>> & extents) const;
+
+	/**
+	 * @brief Writes bytes at a given offset of a file, see write_at().
+	 */
+	void write_inode_at(std::uint64_t number, json & inode, int offset, const char * buffer, int size) const;
+
+	/**
+	 * @brief Stores new content for a file, without moving any data already on the device.
+	 *
+	 * @param number The inode number of the file.
+	 * @param inode The inode record of the file.
 	 * @param buffer A buffer containing the new content.
+	 * @param size The size of the new content in bytes.
+	 *
+	 * @throws std::runtime_error If the device does not have enough free space for the new content.
+	 *
+	 * @details Files up to the inline threshold are stored as hex in the inode's "inline" field.
+	 *          Files up to SlabAllocator::MAX_SLOT_SIZE bytes are kept in a single slab slot and are
+	 *          rewritten in place while their size class does not change.
+	 *          For larger files, holes are dropped and shrinking frees the extents past the new size. Growing first extends
+	 *          the last extent in place and otherwise adds new extents wherever the allocator finds
+	 *          free space, so a file can grow on a fragmented device. The content is then scattered
+	 *          over the extents.
+	 */
+	void write_inode(std::uint64_t number, json & inode, const char * buffer, int size) const;
+
+	/**
+	 * @brief Returns extents to the slab or space allocator they came from.
+	 */
+	void free_extents(const std::vector<std::pair<int, int>> & extents) const;
+
+	/**
+	 * @return true if the extents are a single slab slot.
+	 */
+	bool in_slot(const std::vector<std::pair<int, int>> & extents) const;
+
+	/**
+	 * @brief Locks the space for a whole write when deduplication is on, and returns an empty lock
+	 *        otherwise.
 	 *
-	 * @throws std::runtime_error If the new size of the file exceeds the block device size.
+	 * A deduplicating write can start sharing a chunk of any file, which nobody may be writing
+	 * through meanwhile, so such writes run one at a time. Otherwise the allocators and indexes
+	 * are locked only while they change, and the data is copied under the inode lock alone.
+	 */
+	std::unique_lock<std::recursive_mutex> space_for_write() const;
+
+	/**
+	 * Held by every operation that changes the filesystem, before any lock. It waits while another
+	 * thread's transaction is open, and begin() waits for those holding one to finish.
+	 */
+	class Mutation {
+	public:
+		explicit Mutation(const MyFs & fs);
+		~Mutation();
+
+		Mutation(const Mutation &) = delete;
+		Mutation & operator=(const Mutation &) = delete;
+
+	private:
+		const MyFs & _fs;
+	};
+
+	/**
+	 * @brief Throws unless the calling thread owns the transaction in progress.
+	 */
+	void check_owner() const;
+
+	/**
+	 * @brief Lets the operations waiting for the transaction go on.
+	 */
+	void release_owner() const;
+
+	/**
+	 * @brief Frees all extents of a file and deletes its inode record.
 	 *
-	 * @note This function adjusts the 'begin' and 'end' values for all files in the JSON structure
-	 *       where the 'begin' value is greater than the current 'begin' value of the edited file.
-	 *       It also writes the new content to the block device and updates the 'begin' and 'end'
-	 *       values of the edited file in the JSON structure.
+	 * @param file The file entry, which is left in its directory.
+	 */
+	void release_inode(json & file) const;
+
+	/**
+	 * @brief Moves the [begin, end] ranges that older instances kept in file entries into inodes.
 	 */
-		void resize_bd(json * current, const std::string & content, const char * buffer) const;
+	void upgrade_files(json & node) const;
 
 	/**
-	 * @brief Helper function to recursively traverse JSON and adjust 'begin' and 'end' values.
+	 * @brief Moves the first bytes of a file extent down into a gap and updates the metadata.
 	 *
-	 * @details This function is used to adjust the 'begin' and 'end' values of files in the JSON structure
-	 *          when a file is deleted or its content is modified. It ensures that the 'begin' and 'end'
-	 *          values of all subsequent files are updated accordingly.
+	 * @param number The inode owning the extent.
+	 * @param from The offset of the extent.
+	 * @param length The size of the extent.
+	 * @param to The offset of the gap, below from.
+	 * @param moved The number of bytes to move, at most length and never more than the gap holds.
+	 */
+	void move_extent(std::uint64_t number, int from, int length, int to, int moved) const;
+
+	/**
+	 * @brief Moves a whole slab page down into a gap and updates the files stored in it.
+	 */
+	void move_slab_page(int from, int to) const;
+
+	/**
+	 * @brief Saves the json tree through the metadata writer and publishes the version readers
+	 *        see. The tree lock must be held exclusively.
+	 */
+	void flush() const;
+
+	/**
+	 * @brief Builds the version readers see from the last one and the changes recorded since,
+	 *        publishes it, and retires the last one together with the space freed while it was
+	 *        current. The tree lock must be held exclusively.
 	 *
-	 * @param node The JSON node to be traversed.
-	 * @param origin_begin The original 'begin' value of the file being modified or deleted.
-	 * @param chunk_to_cut_from_begin_and_end The number of steps to reduce from each 'begin' and 'end'
-	 *                                         of a file, which is equal to the size of the file being
-	 *                                         modified or deleted.
+	 * Only the changed inode records and the directories on the path to a changed directory are
+	 * copied, everything else is shared with the last version.
+	 */
+	void publish() const;
+
+	/**
+	 * @brief Publishes the next version like publish(), with the tree lock held shared. The
+	 *        last version is retired without space, no space may be waiting to be freed.
+	 */
+	void publish_shared() const;
+
+	/**
+	 * @return The version following old, which may be null, built from the changes recorded
+	 *         since it. The parts of the json tree copied are locked while they are read.
+	 */
+	std::unique_ptr<Version> next_version(const Version * old) const;
+
+	/**
+	 * @brief Copies an inode record into a version, or drops it from the version if the record
+	 *        was removed. The inode table lock must be held.
+	 */
+	void copy_record(Version & version, std::uint64_t number) const;
+
+	/**
+	 * @return The entries of a directory of the json tree, sharing the subdirectories previous
+	 *         has under the same names; previous may be null. The records of files version does
+	 *         not have yet are copied into it.
+	 */
+	std::shared_ptr<const ReadDirectory> read_directory(const json & directory, const ReadDirectory * previous,
+	                                                    Version & version) const;
+
+	/**
+	 * @return A root whose directory at names, from depth on, is replaced with directory. The
+	 *         root itself is given back if a directory on the way is missing from it.
+	 */
+	static std::shared_ptr<const ReadDirectory> with_directory(const std::shared_ptr<const ReadDirectory> & root,
+	                                                           const std::vector<std::string> & names,
+	                                                           std::size_t depth,
+	                                                           std::shared_ptr<const ReadDirectory> directory);
+
+	/**
+	 * @return What a path leads to in a version.
+	 * @throws std::runtime_error If it leads nowhere.
+	 */
+	static Found find_in(const Version & version, const std::vector<std::string> & tokens);
+
+	/**
+	 * @return The inode record of a file in a version.
+	 */
+	static const json & inode_in(const Version & version, std::uint64_t number);
+
+	/**
+	 * @brief Frees the retired versions, and the space they refer to, that no reader can still
+	 *        hold. The tree lock must be held exclusively, or shared with the space lock.
+	 */
+	void reclaim() const;
+
+	/**
+	 * @brief Rebuilds the extent index from the json tree, leaving out shared ranges.
+	 */
+	void index_extents() const;
+
+	/**
+	 * @brief Drops the references the files of a json tree hold on the ranges they use, freeing
+	 *        those no other tree refers to. Slab slots are left to the caller.
+	 */
+	void drop_references(const json & tree) const;
+
+	/**
+	 * @return The slab slots the files of a json tree are stored in.
+	 */
+	std::unordered_set<int> slots_of(const json & tree) const;
+
+	/**
+	 * @brief Moves a file out of a slot the metadata saved before the transaction refers to, so
+	 *        the slot is never written. Does nothing for other files or outside a transaction.
+	 */
+	void leave_committed_slot(std::uint64_t number, json & inode, std::vector<std::pair<int, int>> & extents) const;
+
+	/**
+	 * @brief Records that the json tree changed, save_changes() saves it.
+	 */
+	void changed() const {
+		++_changes;
+	}
+
+	/**
+	 * @brief Records that an inode record changed or was removed. Writers record it as soon as they
+	 *        hold the inode's lock, so a change that fails halfway still reaches the next version.
+	 */
+	void changed_inode(std::uint64_t number) const;
+
+	/**
+	 * @brief Records that the entries of a directory changed.
+	 * @param names The names leading to the directory from the root, none for the root.
+	 */
+	void changed_entries(std::vector<std::string> names) const;
+
+	/**
+	 * @brief Records the directories and inode records an operation changed as one change, so no
+	 *        version published meanwhile has some of them without the others.
+	 */
+	void changed_entries(const std::vector<std::vector<std::string>> & directories,
+	                     const std::vector<std::uint64_t> & inodes) const;
+
+	/**
+	 * @brief Records that the next version has to be built from the whole json tree. Unlike the
+	 *        other marks it leaves the change count alone, the caller flushes itself.
+	 */
+	void changed_all() const;
+
+	/**
+	 * @brief Saves the json tree unless a flush already covered every change made so far.
 	 *
-	 * @return void.
+	 * Operations running at the same time share one flush: the first to get the tree lock saves
+	 * the changes of all of them, the others find nothing left to do. Without metadata to write,
+	 * and unless space was freed, the version is published with the tree lock held shared instead
+	 * (see publish_shared()). No lock may be held.
+	 */
+	void save_changes() const;
+
+	/**
+	 * @return Whether space freed since the last version waits to be retired with it.
 	 */
-	static void adjust_offsets(json& node, int origin_begin, int chunk_to_cut_from_begin_and_end);
+	bool space_released() const;
 
 	BlockDeviceSimulator *blkdevsim;
+	MetadataWriter _write_metadata;
 
 
 	json * _data{};
+
+	// free space of the block device, the slab pages for small files and the inode owning each used
+	// range, all rebuilt from _data
+	mutable SpaceAllocator _allocator;
+	mutable SlabAllocator _slabs{_allocator};
+	mutable ExtentIndex _index;
+
+	// reference counts of the ranges shared by cloned files, rebuilt from _data as well
+	mutable RefCounts _refs;
+
+	// the chunks stored on the device by content, used while deduplication is on
+	mutable ChunkIndex _chunks;
+	bool _dedup = false;
+
+	// descriptors returned by open()
+	mutable HandleTable _handles;
+
+	// locks, always taken in this order: the tree lock, directory locks, the inode table, inode
+	// locks, then the space lock.
+	//
+	// Operations on files and directory entries hold the tree lock shared; those that change the
+	// tree's shape (remove_dir(), moving a directory), convert or relocate data, or replace the
+	// metadata hold it exclusively, as does saving it. A directory's lock guards its entries and
+	// an inode's lock its record. The inode table lock guards adding and removing records, and the
+	// space lock the allocators, the indexes and the reference counts. The space lock is held only
+	// while those change, never while data is copied (see space_for_write()), and it is recursive
+	// so that the helpers changing them can each take it.
+	mutable RwLock _lock;
+	mutable LockTable _dir_locks;
+	mutable RwLock _inodes_lock;
+	mutable LockTable _inode_locks;
+	mutable std::recursive_mutex _space_lock;
+
+	// changes made to the json tree and how many of them are on disk, see save_changes()
+	mutable std::atomic<std::uint64_t> _changes{0};
+	mutable std::atomic<std::uint64_t> _flushed{0};
+
+	// get_content(), read_at() and list_dir() take no lock and copy nothing: they pin an epoch and
+	// read the version published last. Writers record what they change, and the next version is
+	// built from the last one and those marks, copying each part under its own lock. Space
+	// freed while a version was current may still be read through it, it goes back to the
+	// allocators only once no reader is pinned early enough to hold that version.
+	struct Retired {
+		std::uint64_t epoch;                       // the epoch in which the version was replaced
+		std::unique_ptr<const Version> version;
+		std::vector<std::pair<int, int>> ranges;   // freed while the version was current
+		std::vector<int> slots;
+	};
+	mutable EpochManager _epochs;
+	mutable std::atomic<const Version *> _version{nullptr};
+	mutable std::vector<std::pair<int, int>> _released;
+	mutable std::vector<int> _released_slots;
+	mutable std::deque<Retired> _retired;
+
+	// what changed since the last version was published, see publish(). Versions published with
+	// the tree lock held shared are built one at a time
+	mutable std::mutex _publish_lock;
+	mutable std::mutex _dirty_lock;
+	mutable std::unordered_set<std::uint64_t> _dirty_inodes;
+	mutable std::set<std::vector<std::string>> _dirty_directories;
+	mutable bool _dirty_all = true;
+
+	// between begin() and commit() or abort(): the files of the saved tree hold a reference on
+	// every range they use, as a clone would, so writes replace those ranges instead of going
+	// through them and freeing them leaves them allocated. Slots are not reference counted, the
+	// saved tree's slots are never written and every slot freed is held until the end instead.
+	struct Transaction {
+		json committed;                  // the tree as of begin()
+		std::unordered_set<int> slots;   // the slots it refers to
+		std::vector<int> released_slots;
+	};
+	std::unique_ptr<Transaction> _transaction;
+
+	// the thread that owns the transaction, none outside one, and the changes running meanwhile;
+	// see Mutation
+	mutable std::mutex _owner_lock;
+	mutable std::condition_variable _owner_changed;
+	mutable std::thread::id _owner;
+	mutable int _mutating = 0;
+
+	// files up to this many bytes are stored in their inode record
+	int _inline_threshold = DEFAULT_INLINE_THRESHOLD;
+	static const int DEFAULT_INLINE_THRESHOLD = 48;
+	std::unique_ptr<Defragmenter> _defragmenter;
 	static const uint8_t CURR_VERSION = 0x03;
+	// the bytes of a compressed file each chunk holds
+	static constexpr int COMPRESSED_CHUNK_SIZE = 4096;
+	// the offset of an extent that is a hole: it reads as zeros and uses no device space
+	static constexpr int HOLE = -1;
 	static const char *MYFS_MAGIC;
 };
 
@@ -0,0 +1,312 @@
+#include "myfs.h"
+#include "volume.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// removes the device and its metadata, so the next mount formats them
+const std::string & wiped(const std::string & device) {
+	std::remove(device.c_str());
+	std::remove((device + Volume::METADATA_SUFFIX).c_str());
+	return device;
+}
+
+/**
+ * @brief A freshly formatted volume. Its metadata is saved only when it goes away, so the numbers
+ *        are the filesystem's and not those of rewriting the metadata file.
+ */
+struct Fresh {
+	explicit Fresh(const std::string & device) : volume(wiped(device), Volume::FlushPolicy::ON_SYNC) {
+	}
+
+	Volume volume;
+};
+
+template <typename F>
+double seconds_of(F && run) {
+	const auto start = std::chrono::steady_clock::now();
+	run();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// runs work(thread) on threads threads at once
+template <typename F>
+double seconds_on(const int threads, F && work) {
+	std::vector<std::thread> pool;
+	return seconds_of([&] {
+		for (int thread = 0; thread < threads; ++thread) {
+			pool.emplace_back(work, thread);
+		}
+		for (auto & thread : pool) {
+			thread.join();
+		}
+	});
+}
+
+const int THREADS[] = {1, 2, 4, 8};
+
+// takes what list_dir() prints, so the numbers are not those of the terminal
+struct Discard : std::streambuf {
+	int overflow(const int ch) override {
+		return ch;
+	}
+};
+
+std::string random_bytes(const int size, std::mt19937 & random) {
+	// every byte value, NUL and newline included
+	std::string bytes(size, '\0');
+	for (auto & byte : bytes) {
+		byte = static_cast<char>(random());
+	}
+	return bytes;
+}
+
+std::string size_name(const int size) {
+	if (size >= 1024 * 1024) return std::to_string(size / (1024 * 1024)) + " MiB";
+	if (size >= 1024) return std::to_string(size / 1024) + " KiB";
+	return std::to_string(size) + " B";
+}
+
+// binary payloads written with set_content and read back with get_content
+void payload(const std::string & device) {
+	Fresh fresh(device);
+	MyFs & fs = fresh.volume.fs();
+	fs.create_file("/payload", false);
+	std::mt19937 random(1);
+
+	// the device holds 1 MiB, so the largest payload is half of it rather than 100 MiB
+	std::printf("%10s %14s %12s %14s %12s\n", "size", "writes/s", "write MiB/s", "reads/s", "read MiB/s");
+	for (const int size : {1, 16, 256, 4 * 1024, 64 * 1024, 512 * 1024}) {
+		const std::string bytes = random_bytes(size, random);
+		const int rounds = std::max(16, std::min(100000, 256 * 1024 * 1024 / size));
+
+		const double written = seconds_of([&] {
+			for (int i = 0; i < rounds; ++i) {
+				fs.set_content("/payload", bytes);
+			}
+		});
+		std::string content;
+		const double read = seconds_of([&] {
+			for (int i = 0; i < rounds; ++i) {
+				content = fs.get_content("/payload");
+			}
+		});
+		if (content != bytes) throw std::runtime_error("payload of " + size_name(size) + " read back wrong");
+
+		const double mib = static_cast<double>(size) * rounds / (1024 * 1024);
+		std::printf("%10s %14.0f %12.1f %14.0f %12.1f\n", size_name(size).c_str(), rounds / written, mib / written,
+		            rounds / read, mib / read);
+	}
+}
+
+// get_content and list_dir from many threads at once, nothing writes
+void reads(const std::string & device) {
+	Fresh fresh(device);
+	MyFs & fs = fresh.volume.fs();
+	std::mt19937 random(1);
+	fs.create_file("/files", true);
+	std::vector<std::string> names;
+	for (int i = 0; i < 64; ++i) {
+		names.push_back("/files/" + std::to_string(i));
+		fs.create_file(names.back(), false);
+		fs.set_content(names.back(), random_bytes(256, random));
+	}
+
+	Discard discard;
+	std::streambuf * out = std::cout.rdbuf(&discard);
+	const int rounds = 20000;
+	std::printf("%10s %14s\n", "threads", "reads/s");
+	for (const int threads : THREADS) {
+		const double seconds = seconds_on(threads, [&](const int thread) {
+			std::mt19937 pick(thread);
+			std::string content;
+			for (int i = 0; i < rounds; ++i) {
+				if (i % 16 == 0) {
+					fs.list_dir("/files");
+				} else {
+					content = fs.get_content(names[pick() % names.size()]);
+				}
+			}
+		});
+		std::printf("%10d %14.0f\n", threads, threads * rounds / seconds);
+	}
+	std::cout.rdbuf(out);
+}
+
+// creates in a directory per thread. The volume saves metadata on sync only, so publishing the
+// version holds the tree lock shared as well: what they have in common is the inode table and
+// one publish at a time
+void creates(const std::string & device) {
+	const int rounds = 500;
+	std::printf("%10s %14s\n", "threads", "creates/s");
+	for (const int threads : THREADS) {
+		Fresh fresh(device);
+		MyFs & fs = fresh.volume.fs();
+		for (int thread = 0; thread < threads; ++thread) {
+			fs.create_file("/" + std::to_string(thread), true);
+		}
+
+		const double seconds = seconds_on(threads, [&](const int thread) {
+			const std::string directory = "/" + std::to_string(thread) + "/";
+			for (int i = 0; i < rounds; ++i) {
+				fs.create_file(directory + std::to_string(i), false);
+			}
+		});
+		std::printf("%10d %14.0f\n", threads, threads * rounds / seconds);
+	}
+}
+
+// reads while one more thread keeps writing, the readers never wait for the writer
+void mixed(const std::string & device) {
+	const int rounds = 20000;
+	std::printf("%10s %14s %14s\n", "readers", "reads/s", "writes/s");
+	for (const int threads : THREADS) {
+		Fresh fresh(device);
+		MyFs & fs = fresh.volume.fs();
+		std::mt19937 random(1);
+		std::vector<std::string> names;
+		for (int i = 0; i < 64; ++i) {
+			names.push_back("/" + std::to_string(i));
+			fs.create_file(names.back(), false);
+			fs.set_content(names.back(), random_bytes(256, random));
+		}
+
+		std::atomic<bool> done{false};
+		long writes = 0;
+		std::thread writer([&] {
+			std::mt19937 pick(threads);
+			const std::string bytes = random_bytes(64, pick);
+			while (!done) {
+				fs.write_at(names[pick() % names.size()], static_cast<int>(pick() % 192), bytes);
+				++writes;
+			}
+		});
+		const double seconds = seconds_on(threads, [&](const int thread) {
+			std::mt19937 pick(thread);
+			std::string content;
+			for (int i = 0; i < rounds; ++i) {
+				content = fs.get_content(names[pick() % names.size()]);
+			}
+		});
+		done = true;
+		writer.join();
+		std::printf("%10d %14.0f %14.0f\n", threads, threads * rounds / seconds, writes / seconds);
+	}
+}
+
+// the same content written to many files, with deduplication off and on
+void dedup(const std::string & device) {
+	std::mt19937 random(1);
+	const std::string bytes = random_bytes(16 * 1024, random);
+	const int files = 48;
+	std::printf("%10s %14s %12s %12s %10s\n", "dedup", "writes/s", "MiB/s", "used KiB", "ratio");
+	for (const bool enabled : {false, true}) {
+		Fresh fresh(device);
+		MyFs & fs = fresh.volume.fs();
+		fs.set_dedup(enabled);
+		const double seconds = seconds_of([&] {
+			for (int i = 0; i < files; ++i) {
+				const std::string name = "/" + std::to_string(i);
+				fs.create_file(name, false);
+				fs.set_content(name, bytes);
+			}
+		});
+		if (fs.get_content("/0") != bytes) throw std::runtime_error("deduplicated content read back wrong");
+
+		// the bytes the files refer to for each byte stored
+		const MyFs::Usage usage = fs.usage();
+		std::printf("%10s %14.0f %12.1f %12d %10.2f\n", enabled ? "on" : "off", files / seconds,
+		            static_cast<double>(bytes.size()) * files / (1024 * 1024) / seconds, usage.used / 1024,
+		            static_cast<double>(usage.referenced) / usage.used);
+	}
+}
+
+// read_at of 4 KiB at random offsets of a text file, stored plain and compressed
+void compressed(const std::string & device) {
+	std::mt19937 random(1);
+	const char * const words[] = {"block", "device", "inode", "extent", "chunk", "the", "of", "metadata", "file"};
+	std::string text;
+	while (text.size() < 512 * 1024) {
+		text += words[random() % std::size(words)];
+		text += random() % 12 == 0 ? '\n' : ' ';
+	}
+	text.resize(512 * 1024);
+
+	const int rounds = 20000;
+	const int length = 4 * 1024;
+	std::printf("%10s %12s %14s %12s\n", "compressed", "used KiB", "reads/s", "read MiB/s");
+	for (const bool enabled : {false, true}) {
+		Fresh fresh(device);
+		MyFs & fs = fresh.volume.fs();
+		fs.create_file("/text", false);
+		fs.set_compression("/text", enabled);
+		fs.set_content("/text", text);
+
+		std::string content;
+		const double seconds = seconds_of([&] {
+			for (int i = 0; i < rounds; ++i) {
+				const int offset = static_cast<int>(random() % (text.size() - length));
+				content = fs.read_at("/text", offset, length);
+			}
+		});
+		if (content.size() != static_cast<std::size_t>(length)) throw std::runtime_error("short read");
+
+		const double mib = static_cast<double>(length) * rounds / (1024 * 1024);
+		std::printf("%10s %12d %14.0f %12.1f\n", enabled ? "yes" : "no", fs.usage().used / 1024, rounds / seconds,
+		            mib / seconds);
+	}
+}
+
+struct Bench {
+	const char * name;
+	void (*run)(const std::string & device);
+};
+
+const Bench BENCHES[] = {
+	{"dedup", dedup},
+	{"compressed", compressed},
+	{"payload", payload},
+	{"reads", reads},
+	{"creates", creates},
+	{"mixed", mixed},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		std::cerr << "usage: myfs_bench <device file> [benchmark...]" << std::endl;
+		return -1;
+	}
+	const std::string device = argv[1];
+
+	// every benchmark runs unless some are named
+	int failed = 0;
+	for (const Bench & bench : BENCHES) {
+		bool selected = argc == 2;
+		for (int i = 2; i < argc; ++i) {
+			selected = selected || bench.name == std::string(argv[i]);
+		}
+		if (!selected) continue;
+
+		std::cout << "== " << bench.name << std::endl;
+		try {
+			bench.run(device);
+		} catch (std::runtime_error &e) {
+			std::cerr << bench.name << ": " << e.what() << std::endl;
+			++failed;
+		}
+	}
+	wiped(device);
+	return failed;
+}
@@ -1,6 +1,5 @@
-#include "blkdev.h"
-#include "myfs.h"
 #include "vfs.h"
+#include "volume.h"
 
 #include <iostream>
 
@@ -11,6 +10,7 @@ int main(int argc, char **argv) {
 		std::cerr << "Please provide the file to operate on" << std::endl;
 		return -1;
 	}
-	MyFs myfs(new BlockDeviceSimulator(argv[1]) );
-	VFS::run(myfs, argv[1]);
+	Volume volume(argv[1]);
+	volume.fs().start_defragmenter();
+	VFS(volume.fs()).run();
 }
@@ -0,0 +1,260 @@
+#include "myfs.h"
+#include "volume.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+
+// removes the device and its metadata, so the next mount formats them
+const std::string & wiped(const std::string & device) {
+	std::remove(device.c_str());
+	std::remove((device + Volume::METADATA_SUFFIX).c_str());
+	return device;
+}
+
+void check(const bool ok, const std::string & what) {
+	if (!ok) throw std::runtime_error(what);
+}
+
+// bytes that neither repeat nor compress to nothing, the same for the same seed
+std::string text(const std::size_t size, unsigned seed) {
+	static const char WORDS[][8] = {"block ", "inode ", "extent ", "slab ", "chunk ", "clone ", "dir ", "\n"};
+	std::string bytes;
+	while (bytes.size() < size) {
+		seed = seed * 1103515245 + 12345;
+		bytes += WORDS[(seed >> 16) % 8];
+		bytes += std::to_string(seed % 1000);
+	}
+	bytes.resize(size);
+	return bytes;
+}
+
+bool throws(const std::function<void()> & run) {
+	try {
+		run();
+	} catch (std::runtime_error &) {
+		return true;
+	}
+	return false;
+}
+
+// a change from another thread waits for the transaction instead of joining it, and only the
+// owner can end it
+void transaction_owner(const std::string & device) {
+	Volume volume(wiped(device));
+	MyFs & fs = volume.fs();
+
+	fs.begin();
+	std::atomic<bool> created{false};
+	std::thread other([&] {
+		fs.create_file("/other", false);
+		created = true;
+	});
+	bool committed = true;
+	std::thread([&] { committed = !throws([&] { fs.commit(); }); }).join();
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	const bool early = created;
+	fs.create_file("/mine", false);
+	if (!committed) fs.abort();
+	other.join();
+	check(!committed, "another thread committed the transaction");
+	check(!early, "another thread's change ran inside the transaction");
+
+	// the abort dropped the owner's change only
+	check(created, "another thread's change never ran");
+	check(!throws([&] { (void)fs.get_content("/other"); }), "another thread's change was aborted");
+	check(throws([&] { (void)fs.get_content("/mine"); }), "the aborted change is still there");
+	check(throws([&] { fs.abort(); }), "a transaction is still in progress");
+}
+
+// a write to a clone gets private space, the source keeps its bytes
+void clone_copy_on_write(const std::string & device) {
+	Volume volume(wiped(device));
+	MyFs & fs = volume.fs();
+
+	const std::string original = text(20000, 1);
+	fs.create_file("/a", false);
+	fs.set_content("/a", original);
+	fs.clone("/a", "/b");
+	fs.write_at("/b", 5000, "changed");
+
+	std::string changed = original;
+	changed.replace(5000, 7, "changed");
+	check(fs.get_content("/a") == original, "the write to the clone changed the source");
+	check(fs.get_content("/b") == changed, "the clone lost its write");
+}
+
+// bytes past the end, after a shrink or a write further on, read back as zeros
+void sparse_reads(const std::string & device) {
+	Volume volume(wiped(device));
+	MyFs & fs = volume.fs();
+
+	const std::string original = text(10000, 2);
+	fs.create_file("/f", false);
+	fs.set_content("/f", original);
+	fs.truncate("/f", 3000);
+	fs.truncate("/f", 8000);
+	check(fs.get_content("/f") == original.substr(0, 3000) + std::string(5000, '\0'),
+	      "a grown file does not read zeros past its old size");
+
+	fs.write_at("/f", 100000, "end");
+	const std::string content = fs.get_content("/f");
+	check(content.size() == 100003, "a write past the end did not extend the file");
+	check(content.substr(3000, 97000) == std::string(97000, '\0'), "the hole does not read zeros");
+	check(content.substr(100000) == "end", "the write past the end was lost");
+}
+
+// a rename that replaces a file leaves the moved file at the path and frees the replaced one
+void rename_replace(const std::string & device) {
+	Volume volume(wiped(device));
+	MyFs & fs = volume.fs();
+
+	fs.create_file("/dir", true);
+	fs.create_file("/dir/old", false);
+	fs.set_content("/dir/old", text(30000, 3));
+	const int used = fs.usage().used;
+	fs.create_file("/new", false);
+	fs.set_content("/new", text(30000, 4));
+
+	check(throws([&] { fs.rename("/new", "/dir/old"); }), "a rename replaced a file without being asked");
+	fs.rename("/new", "/dir/old", true);
+	check(fs.get_content("/dir/old") == text(30000, 4), "the path does not refer to the moved file");
+	check(throws([&] { (void)fs.get_content("/new"); }), "the moved file is still at its old path");
+	check(fs.usage().used == used, "the replaced file's space was not freed");
+}
+
+// an abort puts back the bytes the transaction overwrote and the space it allocated
+void abort_restores(const std::string & device) {
+	Volume volume(wiped(device));
+	MyFs & fs = volume.fs();
+
+	const std::string original = text(20000, 5);
+	fs.create_file("/f", false);
+	fs.set_content("/f", original);
+	const int used = fs.usage().used;
+
+	fs.begin();
+	fs.write_at("/f", 1000, text(15000, 6));
+	fs.append("/f", text(40000, 7));
+	fs.create_file("/g", false);
+	fs.set_content("/g", text(50000, 8));
+	fs.abort();
+
+	check(fs.get_content("/f") == original, "the abort did not restore the file's bytes");
+	check(throws([&] { (void)fs.get_content("/g"); }), "the aborted file is still there");
+	check(fs.usage().used == used, "the abort did not free the transaction's space");
+}
+
+// a write that fails halfway for lack of space still leaves the file readable once the space it
+// moved out of is freed and reused
+void failed_write(const std::string & device) {
+	Volume volume(wiped(device));
+	MyFs & fs = volume.fs();
+
+	const std::string original = text(5000, 12);
+	fs.create_file("/f", false);
+	fs.set_content("/f", original);
+	fs.begin();
+	check(throws([&] { fs.preallocate("/f", 4 * BlockDeviceSimulator::DEVICE_SIZE); }), "preallocated past the device");
+	fs.commit();
+
+	fs.create_file("/g", false);
+	fs.set_content("/g", text(5000, 13));
+	check(fs.get_content("/f") == original, "the failed write lost the file's content");
+}
+
+// content kept inline takes no device space but counts as referenced, once per copy
+void inline_usage(const std::string & device) {
+	Volume volume(wiped(device));
+	MyFs & fs = volume.fs();
+
+	const MyFs::Usage before = fs.usage();
+	fs.create_file("/small", false);
+	fs.set_content("/small", text(40, 11));
+	fs.clone("/small", "/copy");
+	const MyFs::Usage after = fs.usage();
+	check(after.used == before.used, "inline content took device space");
+	check(after.referenced - after.used == before.referenced - before.used + 80,
+	      "inline content is not counted as referenced");
+}
+
+// deduplicated and compressed files read back the same after the device is mounted again, which
+// keeps deduplicating
+void remount(const std::string & device) {
+	const std::string shared = text(40000, 9);
+	const std::string packed = text(30000, 10);
+	{
+		Volume volume(wiped(device));
+		MyFs & fs = volume.fs();
+		fs.set_dedup(true);
+		fs.create_file("/first", false);
+		fs.set_content("/first", shared);
+		fs.create_file("/second", false);
+		fs.set_content("/second", shared);
+		fs.write_at("/second", 12345, "diverged");
+		fs.create_file("/packed", false);
+		fs.set_compression("/packed", true);
+		fs.set_content("/packed", packed);
+		fs.append("/packed", "tail");
+	}
+
+	Volume volume(device);
+	MyFs & fs = volume.fs();
+	std::string diverged = shared;
+	diverged.replace(12345, 8, "diverged");
+	check(fs.get_content("/first") == shared, "a deduplicated file changed across the remount");
+	check(fs.get_content("/second") == diverged, "a file sharing chunks changed across the remount");
+	check(fs.get_content("/packed") == packed + "tail", "a compressed file changed across the remount");
+
+	const int used = fs.usage().used;
+	fs.create_file("/third", false);
+	fs.set_content("/third", shared);
+	check(fs.usage().used - used < static_cast<int>(shared.size()) / 2, "deduplication is off after the remount");
+}
+
+struct Test {
+	const char * name;
+	void (*run)(const std::string & device);
+};
+
+const Test TESTS[] = {
+	{"transaction_owner", transaction_owner},
+	{"clone_copy_on_write", clone_copy_on_write},
+	{"sparse_reads", sparse_reads},
+	{"rename_replace", rename_replace},
+	{"abort_restores", abort_restores},
+	{"failed_write", failed_write},
+	{"inline_usage", inline_usage},
+	{"remount", remount},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		std::cerr << "usage: myfs_test <device file>" << std::endl;
+		return -1;
+	}
+	const std::string device = argv[1];
+
+	int failed = 0;
+	for (const Test & test : TESTS) {
+		try {
+			test.run(device);
+			std::cout << "ok " << test.name << std::endl;
+		} catch (std::runtime_error &e) {
+			std::cerr << "FAILED " << test.name << ": " << e.what() << std::endl;
+			++failed;
+		}
+	}
+	wiped(device);
+	return failed;
+}
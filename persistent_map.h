@@ -0,0 +1,158 @@
+#ifndef PERSISTENT_MAP_H_
+#define PERSISTENT_MAP_H_
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+
+/**
+ * PersistentMap is an ordered map that is never changed once built: insert() and erase() return a
+ * new map and leave the old one as it was.
+ *
+ * It is a treap whose nodes are shared between versions. An update copies only the O(log n) nodes
+ * on the path to the key, so keeping many versions alive costs little. A map can be read from
+ * any number of threads while new versions are built from it, and find() and for_each() touch no
+ * reference count, so readers write to no shared memory.
+ */
+template <typename K, typename V>
+class PersistentMap {
+public:
+	PersistentMap() = default;
+
+	/**
+	 * @return The value stored under key, or nullptr if there is none. It lives as long as the map.
+	 */
+	[[nodiscard]] const V * find(const K & key) const {
+		return find_in(_root.get(), key);
+	}
+
+	/**
+	 * @return A map holding value under key, replacing the value stored before.
+	 */
+	[[nodiscard]] PersistentMap insert(const K & key, V value) const {
+		bool added = false;
+		Link root = insert(_root, key, std::move(value), priority_of(key), added);
+		return PersistentMap(std::move(root), _size + (added ? 1 : 0));
+	}
+
+	/**
+	 * @return A map without key. Unknown keys give back the same map.
+	 */
+	[[nodiscard]] PersistentMap erase(const K & key) const {
+		if (find(key) == nullptr) return *this;
+		return PersistentMap(erase(_root, key), _size - 1);
+	}
+
+	/**
+	 * @brief Calls visit(key, value) for every entry, in key order.
+	 */
+	template <typename F>
+	void for_each(F && visit) const {
+		for_each(_root.get(), visit);
+	}
+
+	[[nodiscard]] std::size_t size() const {
+		return _size;
+	}
+
+private:
+	struct Node;
+	using Link = std::shared_ptr<const Node>;
+
+	struct Node {
+		K key;
+		V value;
+		std::uint64_t priority; // a node's priority is above its children's
+		Link left;
+		Link right;
+	};
+
+	PersistentMap(Link root, const std::size_t size) : _root(std::move(root)), _size(size) {}
+
+	static std::uint64_t priority_of(const K & key) {
+		// the priority is a function of the key, so the same entries always make the same tree;
+		// the hash is mixed since std::hash of an integer is the integer itself
+		std::uint64_t x = std::hash<K>()(key) + 0x9e3779b97f4a7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	static Link make(const Node & from, Link left, Link right) {
+		return std::make_shared<const Node>(Node{from.key, from.value, from.priority, std::move(left), std::move(right)});
+	}
+
+	static Link insert(const Link & node, const K & key, V value, const std::uint64_t priority, bool & added) {
+		if (node == nullptr || priority > node->priority) {
+			// the new node goes here, what was below is split around it
+			Link left;
+			Link right;
+			split(node, key, left, right);
+			added = find_in(node.get(), key) == nullptr;
+			return std::make_shared<const Node>(Node{key, std::move(value), priority, std::move(left), std::move(right)});
+		}
+		if (key < node->key) return make(*node, insert(node->left, key, std::move(value), priority, added), node->right);
+		if (node->key < key) return make(*node, node->left, insert(node->right, key, std::move(value), priority, added));
+		return std::make_shared<const Node>(Node{key, std::move(value), priority, node->left, node->right});
+	}
+
+	// the keys below key go to left and those above to right, key itself is dropped
+	static void split(const Link & node, const K & key, Link & left, Link & right) {
+		if (node == nullptr) {
+			left = nullptr;
+			right = nullptr;
+		} else if (node->key < key) {
+			Link rest;
+			split(node->right, key, rest, right);
+			left = make(*node, node->left, std::move(rest));
+		} else if (key < node->key) {
+			Link rest;
+			split(node->left, key, left, rest);
+			right = make(*node, std::move(rest), node->right);
+		} else {
+			left = node->left;
+			right = node->right;
+		}
+	}
+
+	static Link erase(const Link & node, const K & key) {
+		if (key < node->key) return make(*node, erase(node->left, key), node->right);
+		if (node->key < key) return make(*node, node->left, erase(node->right, key));
+		return merge(node->left, node->right);
+	}
+
+	// every key of left is below every key of right
+	static Link merge(const Link & left, const Link & right) {
+		if (left == nullptr) return right;
+		if (right == nullptr) return left;
+		if (left->priority > right->priority) return make(*left, left->left, merge(left->right, right));
+		return make(*right, merge(left, right->left), right->right);
+	}
+
+	static const V * find_in(const Node * node, const K & key) {
+		while (node != nullptr) {
+			if (key < node->key) {
+				node = node->left.get();
+			} else if (node->key < key) {
+				node = node->right.get();
+			} else {
+				return &node->value;
+			}
+		}
+		return nullptr;
+	}
+
+	template <typename F>
+	static void for_each(const Node * node, F & visit) {
+		for (; node != nullptr; node = node->right.get()) {
+			for_each(node->left.get(), visit);
+			visit(node->key, node->value);
+		}
+	}
+
+	Link _root;
+	std::size_t _size = 0;
+};
+
+#endif // PERSISTENT_MAP_H_
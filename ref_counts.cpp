@@ -0,0 +1,108 @@
+#include "ref_counts.h"
+#include <algorithm>
+
+void RefCounts::split(const int offset) {
+	auto it = _ranges.upper_bound(offset);
+	if (it == _ranges.begin()) return;
+	--it;
+	const int begin = it->first;
+	Range & range = it->second;
+	if (offset <= begin || offset >= begin + range.length) return;
+
+	_ranges[offset] = {begin + range.length - offset, range.refs};
+	range.length = offset - begin;
+}
+
+void RefCounts::share(const int offset, const int length) {
+	if (length <= 0) return;
+	split(offset);
+	split(offset + length);
+
+	// bump the stored ranges and store the gaps between them with two references
+	int position = offset;
+	for (auto it = _ranges.lower_bound(offset); it != _ranges.end() && it->first < offset + length; ++it) {
+		if (it->first > position) {
+			_ranges[position] = {it->first - position, 2};
+		}
+		++it->second.refs;
+		position = it->first + it->second.length;
+	}
+	if (position < offset + length) {
+		_ranges[position] = {offset + length - position, 2};
+	}
+}
+
+std::vector<std::pair<int, int>> RefCounts::release(const int offset, const int length) {
+	std::vector<std::pair<int, int>> unused;
+	if (length <= 0) return unused;
+	split(offset);
+	split(offset + length);
+
+	int position = offset;
+	for (auto it = _ranges.lower_bound(offset); it != _ranges.end() && it->first < offset + length;) {
+		if (it->first > position) {
+			unused.emplace_back(position, it->first - position);
+		}
+		position = it->first + it->second.length;
+		// a range left with one reference is no longer shared
+		if (--it->second.refs == 1) {
+			it = _ranges.erase(it);
+		} else {
+			++it;
+		}
+	}
+	if (position < offset + length) {
+		unused.emplace_back(position, offset + length - position);
+	}
+	return unused;
+}
+
+std::vector<std::pair<int, int>> RefCounts::shared(const int offset, const int length) const {
+	std::vector<std::pair<int, int>> ranges;
+	auto it = _ranges.upper_bound(offset);
+	if (it != _ranges.begin()) --it;
+	for (; it != _ranges.end() && it->first < offset + length; ++it) {
+		const int begin = std::max(it->first, offset);
+		const int end = std::min(it->first + it->second.length, offset + length);
+		if (begin < end) ranges.emplace_back(begin, end - begin);
+	}
+	return ranges;
+}
+
+std::vector<std::pair<int, int>> RefCounts::rebuild(std::vector<std::pair<int, int>> extents) {
+	_ranges.clear();
+
+	// sweep over the range boundaries, counting how many files cover each stretch
+	std::vector<std::pair<int, int>> events;
+	events.reserve(2 * extents.size());
+	for (const auto & [offset, length] : extents) {
+		events.emplace_back(offset, 1);
+		events.emplace_back(offset + length, -1);
+	}
+	std::sort(events.begin(), events.end());
+
+	std::vector<std::pair<int, int>> used;
+	int refs = 0;
+	int position = 0;
+	for (const auto & [offset, delta] : events) {
+		if (offset > position && refs > 0) {
+			if (refs > 1) _ranges[position] = {offset - position, refs};
+			if (!used.empty() && used.back().first + used.back().second == position) {
+				used.back().second += offset - position;
+			} else {
+				used.emplace_back(position, offset - position);
+			}
+		}
+		refs += delta;
+		position = offset;
+	}
+	return used;
+}
+
+long RefCounts::saved_bytes() const {
+	long saved = 0;
+	for (const auto & [offset, range] : _ranges) {
+		saved += static_cast<long>(range.length) * (range.refs - 1);
+	}
+	return saved;
+}
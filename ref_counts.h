@@ -0,0 +1,65 @@
+#ifndef REF_COUNTS_H_
+#define REF_COUNTS_H_
+#include <map>
+#include <utility>
+#include <vector>
+
+/**
+ * RefCounts tracks the device ranges that are shared by cloned files.
+ *
+ * Only ranges referenced by two or more files are stored, every other allocated byte implicitly
+ * has a single owner. Ranges are split at whatever byte boundaries sharing and releasing create,
+ * so a file can overwrite part of a shared extent and keep sharing the rest.
+ */
+class RefCounts {
+public:
+	void clear() {
+		_ranges.clear();
+	}
+
+	/**
+	 * @brief Adds a reference to every byte of [offset, offset + length).
+	 */
+	void share(int offset, int length);
+
+	/**
+	 * @brief Drops a reference to every byte of [offset, offset + length).
+	 *
+	 * @return The ranges that had a single reference and are now unused, in offset order.
+	 */
+	std::vector<std::pair<int, int>> release(int offset, int length);
+
+	/**
+	 * @return The parts of [offset, offset + length) referenced by more than one file, as
+	 *         (offset, length) pairs in offset order.
+	 */
+	[[nodiscard]] std::vector<std::pair<int, int>> shared(int offset, int length) const;
+
+	/**
+	 * @brief Recounts the references from every file's extents. Used when loading metadata.
+	 *
+	 * @param extents The device ranges of all files, each appearing once per file using it.
+	 *
+	 * @return The union of the ranges, merged and in offset order, which is what the files use.
+	 */
+	std::vector<std::pair<int, int>> rebuild(std::vector<std::pair<int, int>> extents);
+
+	/**
+	 * @return The bytes that sharing saves: every shared byte counts once per reference but the
+	 *         first.
+	 */
+	[[nodiscard]] long saved_bytes() const;
+
+private:
+	struct Range {
+		int length;
+		int refs;
+	};
+
+	// makes offset the start of a stored range if it falls inside one
+	void split(int offset);
+
+	std::map<int, Range> _ranges; // offset -> range, for ranges with at least two references
+};
+
+#endif // REF_COUNTS_H_
@@ -0,0 +1,48 @@
+#include "rw_lock.h"
+
+void RwLock::lock() {
+	std::unique_lock lock(_mutex);
+	++_waiting_writers;
+	_writers_gate.wait(lock, [this] { return !_writer && _readers == 0; });
+	--_waiting_writers;
+	_writer = true;
+}
+
+bool RwLock::try_lock() {
+	std::lock_guard lock(_mutex);
+	if (_writer || _readers > 0) return false;
+	_writer = true;
+	return true;
+}
+
+void RwLock::unlock() {
+	{
+		std::lock_guard lock(_mutex);
+		_writer = false;
+	}
+	// the next writer goes first, readers only get in once no writer is waiting
+	_writers_gate.notify_one();
+	_readers_gate.notify_all();
+}
+
+void RwLock::lock_shared() {
+	std::unique_lock lock(_mutex);
+	_readers_gate.wait(lock, [this] { return !_writer && _waiting_writers == 0; });
+	++_readers;
+}
+
+bool RwLock::try_lock_shared() {
+	std::lock_guard lock(_mutex);
+	if (_writer || _waiting_writers > 0) return false;
+	++_readers;
+	return true;
+}
+
+void RwLock::unlock_shared() {
+	bool last;
+	{
+		std::lock_guard lock(_mutex);
+		last = --_readers == 0;
+	}
+	if (last) _writers_gate.notify_one();
+}
@@ -0,0 +1,33 @@
+#ifndef RW_LOCK_H_
+#define RW_LOCK_H_
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * RwLock is a readers-writer lock that lets any number of readers in at once and a writer in
+ * alone.
+ *
+ * A waiting writer stops new readers from entering, so a steady stream of reads cannot hold off
+ * writes forever, which a reader-preferring std::shared_mutex allows. It meets the SharedMutex
+ * requirements and works with std::shared_lock, std::unique_lock and std::lock_guard.
+ */
+class RwLock {
+public:
+	void lock();
+	bool try_lock();
+	void unlock();
+
+	void lock_shared();
+	bool try_lock_shared();
+	void unlock_shared();
+
+private:
+	std::mutex _mutex;
+	std::condition_variable _readers_gate; // readers wait here while a writer holds or wants the lock
+	std::condition_variable _writers_gate; // writers wait here while the lock is held
+	int _readers = 0;                      // readers holding the lock
+	int _waiting_writers = 0;
+	bool _writer = false;                  // whether a writer holds the lock
+};
+
+#endif // RW_LOCK_H_
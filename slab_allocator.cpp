@@ -0,0 +1,132 @@
+#include "slab_allocator.h"
+#include <stdexcept>
+
+int SlabAllocator::slot_size_for(const int size) {
+	if (size > MAX_SLOT_SIZE) return 0;
+	int slot_size = MIN_SLOT_SIZE;
+	while (slot_size < size) {
+		slot_size *= 2;
+	}
+	return slot_size;
+}
+
+std::map<int, SlabAllocator::Page>::iterator SlabAllocator::page_of(const int offset) {
+	auto it = _pages.upper_bound(offset);
+	if (it == _pages.begin()) return _pages.end();
+	--it;
+	return offset < it->first + PAGE_SIZE ? it : _pages.end();
+}
+
+bool SlabAllocator::owns(const int offset) const {
+	auto it = _pages.upper_bound(offset);
+	if (it == _pages.begin()) return false;
+	--it;
+	return offset < it->first + PAGE_SIZE;
+}
+
+void SlabAllocator::add_page(const int offset, const int slot_size) {
+	const int slots = PAGE_SIZE / slot_size;
+	Page page{slot_size, 0, std::vector<std::uint64_t>((slots + 63) / 64, 0)};
+	for (int i = 0; i < slots; ++i) {
+		page.free[i / 64] |= std::uint64_t{1} << (i % 64);
+	}
+	_pages[offset] = std::move(page);
+	_with_free[slot_size].insert(offset);
+}
+
+int SlabAllocator::allocate(const int size) {
+	const int slot_size = slot_size_for(size);
+	if (slot_size == 0) return -1;
+
+	auto & candidates = _with_free[slot_size];
+	if (candidates.empty()) {
+		const int offset = _space.allocate(PAGE_SIZE);
+		if (offset == -1) return -1;
+		add_page(offset, slot_size);
+	}
+
+	const int page_offset = *candidates.begin();
+	Page & page = _pages[page_offset];
+	for (size_t word = 0; word < page.free.size(); ++word) {
+		if (page.free[word] == 0) continue;
+		const int bit = __builtin_ctzll(page.free[word]);
+		page.free[word] &= ~(std::uint64_t{1} << bit);
+		if (++page.used == PAGE_SIZE / slot_size) {
+			candidates.erase(page_offset);
+		}
+		return page_offset + (static_cast<int>(word) * 64 + bit) * slot_size;
+	}
+	throw std::runtime_error("Slab page has no free slot");
+}
+
+void SlabAllocator::reserve(const int offset) {
+	const auto it = page_of(offset);
+	if (it == _pages.end())
+		throw std::runtime_error("Metadata refers to a slot outside of the slab pages");
+
+	Page & page = it->second;
+	const int slot = (offset - it->first) / page.slot_size;
+	const std::uint64_t bit = std::uint64_t{1} << (slot % 64);
+	if (!(page.free[slot / 64] & bit))
+		throw std::runtime_error("Metadata refers to a slot that is already in use");
+	page.free[slot / 64] &= ~bit;
+	if (++page.used == PAGE_SIZE / page.slot_size) {
+		_with_free[page.slot_size].erase(it->first);
+	}
+}
+
+void SlabAllocator::release(const int offset) {
+	const auto it = page_of(offset);
+	if (it == _pages.end()) return;
+
+	Page & page = it->second;
+	const int slot = (offset - it->first) / page.slot_size;
+	page.free[slot / 64] |= std::uint64_t{1} << (slot % 64);
+
+	if (--page.used == 0) {
+		// an empty page goes back to the general free space
+		_with_free[page.slot_size].erase(it->first);
+		_space.release(it->first, PAGE_SIZE);
+		_pages.erase(it);
+	} else {
+		_with_free[page.slot_size].insert(it->first);
+	}
+}
+
+void SlabAllocator::clear() {
+	_pages.clear();
+	_with_free.clear();
+}
+
+void SlabAllocator::release_empty_pages() {
+	for (auto it = _pages.begin(); it != _pages.end();) {
+		if (it->second.used == 0) {
+			_with_free[it->second.slot_size].erase(it->first);
+			_space.release(it->first, PAGE_SIZE);
+			it = _pages.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void SlabAllocator::move_page(const int from, const int to) {
+	auto node = _pages.extract(from);
+	if (node.empty()) return;
+	node.key() = to;
+
+	auto & candidates = _with_free[node.mapped().slot_size];
+	if (candidates.erase(from)) {
+		candidates.insert(to);
+	}
+	_pages.insert(std::move(node));
+}
+
+std::vector<std::pair<int, int>> SlabAllocator::pages() const {
+	std::vector<std::pair<int, int>> pages;
+	pages.reserve(_pages.size());
+	for (const auto & [offset, page] : _pages) {
+		pages.emplace_back(offset, page.slot_size);
+	}
+	return pages;
+}
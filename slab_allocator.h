@@ -0,0 +1,95 @@
+#ifndef SLAB_ALLOCATOR_H_
+#define SLAB_ALLOCATOR_H_
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+#include "allocator.h"
+
+/**
+ * SlabAllocator stores small files in fixed-size slots.
+ *
+ * Slots come in power-of-two size classes from MIN_SLOT_SIZE to MAX_SLOT_SIZE. Each slab page is
+ * taken from the SpaceAllocator as a whole and holds slots of a single class, with a bitmap of the
+ * free ones. A small file can change size within its slot without touching any other file, and
+ * freeing a slot is a single bit flip. A page goes back to the SpaceAllocator once it is empty.
+ */
+class SlabAllocator {
+public:
+	static constexpr int PAGE_SIZE = 4096;
+	static constexpr int MIN_SLOT_SIZE = 16;
+	static constexpr int MAX_SLOT_SIZE = 512;
+
+	/**
+	 * @param pages The allocator the slab pages are taken from, it must outlive this object.
+	 */
+	explicit SlabAllocator(SpaceAllocator & pages) : _space(pages) {}
+
+	/**
+	 * @return The size of the smallest slot that holds size bytes, or 0 if size is too large.
+	 */
+	static int slot_size_for(int size);
+
+	/**
+	 * @brief Allocates a slot large enough for size bytes, adding a slab page if needed.
+	 *
+	 * @return The offset of the slot, or -1 if size is too large or no page could be added.
+	 */
+	int allocate(int size);
+
+	/**
+	 * @brief Frees the slot starting at offset.
+	 */
+	void release(int offset);
+
+	/**
+	 * @return true if offset lies inside a slab page.
+	 */
+	[[nodiscard]] bool owns(int offset) const;
+
+	/**
+	 * @brief Forgets every page. The pages are not returned to the SpaceAllocator.
+	 */
+	void clear();
+
+	/**
+	 * @brief Registers an existing page with all of its slots free. Used when loading metadata.
+	 */
+	void add_page(int offset, int slot_size);
+
+	/**
+	 * @brief Marks the slot starting at offset as used. Used when loading metadata.
+	 */
+	void reserve(int offset);
+
+	/**
+	 * @brief Returns every page without a used slot to the SpaceAllocator.
+	 */
+	void release_empty_pages();
+
+	/**
+	 * @brief Changes the offset of a page, after its content was copied to the new offset.
+	 */
+	void move_page(int from, int to);
+
+	/**
+	 * @return Every page as an (offset, slot size) pair, in offset order.
+	 */
+	[[nodiscard]] std::vector<std::pair<int, int>> pages() const;
+
+private:
+	struct Page {
+		int slot_size;
+		int used;
+		std::vector<std::uint64_t> free; // one bit per slot, set when the slot is free
+	};
+
+	std::map<int, Page>::iterator page_of(int offset);
+
+	SpaceAllocator & _space;
+	std::map<int, Page> _pages;                // page offset -> page
+	std::map<int, std::set<int>> _with_free;   // slot size -> pages that have a free slot
+};
+
+#endif // SLAB_ALLOCATOR_H_
@@ -1,11 +1,10 @@
 #include "vfs.h"
-#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
+#include "file_streambuf.h"
 
-MyFs * VFS::_fs = nullptr;
-json VFS::_data;
-std::string VFS::_bd_file_name;
+VFS::VFS(MyFs &fs) : _fs(fs) {}
 
 
 std::vector<std::string> VFS::split_cmd(const std::string& cmd, char delim ) {
@@ -20,63 +19,7 @@ std::vector<std::string> VFS::split_cmd(const std::string& cmd, char delim ) {
 }
 
 
-void VFS::read_json_file(){
-	std::string json_filename = VFS::_bd_file_name + JSON;  // Append '.json' to the filename
-
-	// Attempt to open the file
-	std::ifstream file(json_filename);
-
-	if (file.is_open()) {
-		// File exists, read JSON data from it
-		file >> VFS::_data;
-		file.close();
-	} else {
-		// File doesn't exist, create it and initialize with default data
-		std::ofstream new_file(json_filename);  // This will create the file
-
-		// Initialize with default JSON data if needed
-		_data = {
-			{"/", {
-	                {"type", "directory"},
-					{"contents", json::object()}
-					}
-
-			},
-			{"offset",MyFs::get_header_size()}
-		};
-
-		// Save JSON data to the new file
-		new_file << _data.dump(4);  // Using dump(4) for pretty printing with indentation
-		new_file.close();
-	}
-}
-
-void VFS::write_json_file() {
-	const std::string json_filename = VFS::_bd_file_name + JSON;  // Append '.json' to the filename
-
-	// Attempt to open the file
-	if (std::ofstream file(json_filename); file.is_open()) {
-		// File exists, write JSON data to it
-		file << _data.dump(4);  // Use -> to access pointer member _data
-		file.close();
-	} else {
-		throw std::runtime_error("Failed to open file: " + json_filename);
-	}
-}
-
-
-
-void VFS::init(MyFs &fs, const std::string & fname) {
-	VFS::_bd_file_name = fname;
-	VFS::_fs = &fs;
-	VFS::read_json_file();
-	VFS::_fs->set_json_data(VFS::_data);
-
-}
-
-
-void VFS::run(MyFs &fs, const std::string & fname ) {
-	init(fs, fname);
+void VFS::run() {
 	std::cout << "Welcome to " << FS_NAME << std::endl;
 	std::cout << "To get help, please type 'help' on the prompt below." << std::endl;
 	std::cout << std::endl;
@@ -107,41 +50,111 @@ bool VFS::check_and_activate(const std::string & COMMAND, const std::vector<std:
 		std::cout << HELP_STRING;
 	} else if (COMMAND == LIST_CMD ) {
 		if (cmd.size() == 1) {
-			VFS::_fs->list_dir("/");
+			_fs.list_dir("/");
 		}else {
 			for (unsigned long i = 1; i < cmd.size(); ++i) {
-				VFS::_fs->list_dir(cmd[i]);
+				_fs.list_dir(cmd[i]);
 			}
 		}
 	} else if (COMMAND == CREATE_FILE_CMD) {
 		for (unsigned long i = 1; i < cmd.size(); ++i) {
-			VFS::_fs->create_file(cmd[i], false);
+			_fs.create_file(cmd[i], false);
 		}
 	}else if(COMMAND == CREATE_DIRECTORY_CMD){
 		for (unsigned long i = 1; i < cmd.size(); ++i) {
-			VFS::_fs->create_file(cmd[i], true);
+			_fs.create_file(cmd[i], true);
 		}
 	} else if (COMMAND == CONTENT_CMD){
 
 		if(cmd.size() != 2 ) throw std::runtime_error("cat command usage, cat <file>");
 
-		std::cout << VFS::_fs->get_content(cmd[1]) << std::endl;
+		// the file is copied out one buffer at a time instead of being read whole
+		FileStreamBuf file(_fs, cmd[1]);
+		char chunk[FileStreamBuf::DEFAULT_BUFFER_SIZE];
+		for (std::streamsize n; (n = file.sgetn(chunk, sizeof(chunk))) > 0;) {
+			std::cout.write(chunk, n);
+		}
+		std::cout << std::endl;
 
 	} else if (COMMAND== EDIT_CMD) {
 
 		if(cmd.size() != 2 ) throw std::runtime_error("Edite command usage, edite <file>");
 
-		VFS::_fs->set_content(cmd[1]);
+		_fs.set_content(cmd[1]);
+
+	} else if (COMMAND == APPEND_CMD) {
+
+		if(cmd.size() != 2 ) throw std::runtime_error("Append command usage, append <file>");
+
+		std::string content;
+		std::cout << "Enter content to append" << std::endl;
+		std::getline(std::cin, content);
+		_fs.append(cmd[1], content);
+
+	} else if (COMMAND == TRUNCATE_CMD) {
+
+		if(cmd.size() != 3 ) throw std::runtime_error("Truncate command usage, truncate <file> <size>");
+
+		int size;
+		try {
+			size = std::stoi(cmd[2]);
+		} catch (std::logic_error &) {
+			throw std::runtime_error("Truncate command usage, truncate <file> <size>");
+		}
+		_fs.truncate(cmd[1], size);
+
+	} else if (COMMAND == CLONE_CMD) {
+
+		if(cmd.size() != 3 ) throw std::runtime_error("Clone command usage, clone <file> <new file>");
+
+		_fs.clone(cmd[1], cmd[2]);
+
+	} else if (COMMAND == MOVE_CMD) {
+
+		const bool replace = cmd.size() == 4 && cmd[1] == "-f";
+		if(cmd.size() != (replace ? 4 : 3)) throw std::runtime_error("Move command usage, mv [-f] <path> <new path>");
+
+		_fs.rename(cmd[cmd.size() - 2], cmd.back(), replace);
+
+	} else if (COMMAND == COMPRESS_CMD) {
+
+		if(cmd.size() != 3 || (cmd[2] != "on" && cmd[2] != "off"))
+			throw std::runtime_error("Compress command usage, compress <path> on|off");
+
+		_fs.set_compression(cmd[1], cmd[2] == "on");
+
+	} else if (COMMAND == DEDUP_CMD) {
+
+		if(cmd.size() != 2 || (cmd[1] != "on" && cmd[1] != "off"))
+			throw std::runtime_error("Dedup command usage, dedup on|off");
+
+		_fs.set_dedup(cmd[1] == "on");
+
+	} else if (COMMAND == USAGE_CMD) {
+
+		const MyFs::Usage usage = _fs.usage();
+		std::cout << "size\t" << usage.capacity << std::endl;
+		std::cout << "used\t" << usage.used << std::endl;
+		std::cout << "data\t" << usage.referenced << std::endl;
+		std::cout << "ratio\t" << std::fixed << std::setprecision(2)
+		          << (usage.used == 0 ? 1.0 : static_cast<double>(usage.referenced) / usage.used) << std::endl;
+		std::cout.unsetf(std::ios_base::fixed);
 
 	} else if (COMMAND== REMOVE_CMD) {
 		for (unsigned long i = 1; i < cmd.size(); ++i) {
-			VFS::_fs->remove_file(cmd[i]);
+			_fs.remove_file(cmd[i]);
 		}
 
 	}else if(COMMAND == RMDIR){
 		for (unsigned long i = 1; i < cmd.size(); ++i) {
-			VFS::_fs->remove_dir(cmd[i]);
+			_fs.remove_dir(cmd[i]);
 		}
+	} else if (COMMAND == BEGIN_CMD) {
+		_fs.begin();
+	} else if (COMMAND == COMMIT_CMD) {
+		_fs.commit();
+	} else if (COMMAND == ABORT_CMD) {
+		_fs.abort();
 	}
 	else {
 
@@ -13,7 +13,17 @@ const std::string CONTENT_CMD = "cat";
 const std::string CREATE_FILE_CMD = "touch";
 const std::string CREATE_DIRECTORY_CMD = "mkdir";
 const std::string EDIT_CMD = "edit";
+const std::string APPEND_CMD = "append";
+const std::string TRUNCATE_CMD = "truncate";
+const std::string CLONE_CMD = "clone";
+const std::string MOVE_CMD = "mv";
+const std::string COMPRESS_CMD = "compress";
+const std::string DEDUP_CMD = "dedup";
+const std::string USAGE_CMD = "df";
 const std::string REMOVE_CMD = "rm";
+const std::string BEGIN_CMD = "begin";
+const std::string COMMIT_CMD = "commit";
+const std::string ABORT_CMD = "abort";
 const std::string HELP_CMD = "help";
 const std::string EXIT_CMD = "exit";
 
@@ -24,68 +34,50 @@ const std::string HELP_STRING = "The following commands are supported: \n"
     + CREATE_FILE_CMD + " <path> - create empty file. \n"
     + CREATE_DIRECTORY_CMD + " <path> - create empty directory. \n"
     + EDIT_CMD + " <path> - re-set file content. \n"
+    + APPEND_CMD + " <path> - append a line to the file content. \n"
+    + TRUNCATE_CMD + " <path> <size> - shrink or extend the file to size bytes. \n"
+    + CLONE_CMD + " <path> <new path> - copy the file, sharing its space until either copy changes. \n"
+    + MOVE_CMD + " [-f] <path> <new path> - move a file or directory, -f replaces an existing file. \n"
+    + COMPRESS_CMD + " <path> on|off - compress a file, or a directory and what is created in it. \n"
+    + DEDUP_CMD + " on|off - store each distinct chunk of written data once. \n"
+    + USAGE_CMD + " - show device usage and the space saved by sharing. \n"
     + REMOVE_CMD + " <path> - remove file. \n"
     + RMDIR + " <path> - remove directory. \n"
+    + BEGIN_CMD + " - start a transaction, the commands after it are saved together. \n"
+    + COMMIT_CMD + " - save the changes of the transaction. \n"
+    + ABORT_CMD + " - drop the changes of the transaction. \n"
     + HELP_CMD + " - show this help messege. \n"
     + EXIT_CMD + " - gracefully exit. \n";
 
 
-const std::string JSON = ".json";
-
 class VFS {
 public:
     /**
-     * @brief Runs the Virtual File System (VFS) with the provided MyFs object and file name.
+     * @brief Creates a shell on a mounted filesystem.
      *
-     * This function initializes the VFS with the provided MyFs object and file name, displays a welcome message,
-     * and enters a command loop where the user can interact with the VFS. The command loop reads user input,
-     * splits it into individual commands, and activates the corresponding functionality in the MyFs object.
+     * @param fs A reference to the MyFs object the commands run on, it must outlive the VFS.
+     */
+    explicit VFS(MyFs &fs);
+
+    /**
+     * @brief Runs the Virtual File System (VFS) shell.
      *
-     * @param fs A reference to the MyFs object that will be associated with the VFS.
-     * @param fname A const reference to a string representing the file name for the JSON data.
+     * Displays a welcome message and enters a command loop where the user can interact with the filesystem.
+     * The command loop reads user input, splits it into individual commands, and activates the corresponding
+     * functionality in the MyFs object.
      *
      * @return void
      */
-    static void run(MyFs &fs, const std::string & fname);
+    void run();
 
 
     static std::vector<std::string>  split_cmd(const std::string& cmd, char delim = ' ');
 
-    static void write_json_file();
 private:
-    static bool check_and_activate(const std::string & COMMAND, const std::vector<std::string> & cmd);
-
-    /**
-     * @brief Reads JSON data from a file and initializes the VFS::_data variable.
-     *
-     * This function attempts to open the file specified by the provided filename. If the file exists,
-     * it reads the JSON data from the file and stores it in the VFS::_data variable. If the file doesn't exist,
-     * it creates a new file, initializes it with default JSON data, and stores it in the VFS::_data variable.
-     *
-     * @param filename A const reference to a string representing the name of the file from which to read JSON data.
-     *                  The function appends '.json' to the filename before attempting to open the file.
-     *
-     * @return void
-     */
-    static void read_json_file();
-
-    /**
-     * @brief Initializes the Virtual File System (VFS) with the provided MyFs object and file name.
-     *
-     * This function sets the file name for the VFS, assigns the address of the provided MyFs object to the VFS::_fs,
-     * reads the JSON data from the file specified by fname, and sets the JSON data in the MyFs object.
-     *
-     * @param fs A reference to the MyFs object that will be associated with the VFS.
-     * @param fname A const reference to a string representing the file name for the JSON data.
-     *
-     * @return void
-     */
-    static void init(MyFs &fs, const std::string & fname);
+    bool check_and_activate(const std::string & COMMAND, const std::vector<std::string> & cmd);
 
 
-    static MyFs * _fs;
-    static json _data;
-    static std::string _bd_file_name;
+    MyFs & _fs;
 };
 
 
@@ -0,0 +1,96 @@
+#include "volume.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+const std::string Volume::METADATA_SUFFIX = ".json";
+
+Volume::Volume(const std::string &fname, const FlushPolicy policy)
+	: _fname(fname), _policy(policy), _data(read_metadata(fname + METADATA_SUFFIX)),
+	  _fs(new BlockDeviceSimulator(fname)) {
+	const std::string json_filename = _fname + METADATA_SUFFIX;
+	if (_policy == FlushPolicy::EVERY_CHANGE) {
+		_fs.set_metadata_writer([json_filename](const json &metadata) { write_metadata(json_filename, metadata); });
+	}
+	_fs.set_json_data(_data);
+	// a new volume gets its metadata file right away
+	if (!std::ifstream(json_filename).is_open()) sync();
+}
+
+Volume::~Volume() {
+	// the defragmenter may still be changing the metadata
+	_fs.stop_defragmenter();
+	if (_policy != FlushPolicy::ON_SYNC) return;
+	try {
+		sync();
+	} catch (std::runtime_error &e) {
+		std::cerr << e.what() << std::endl;
+	}
+}
+
+void Volume::sync() {
+	const std::string json_filename = _fname + METADATA_SUFFIX;
+	_fs.save_metadata([&json_filename](const json &metadata) { write_metadata(json_filename, metadata); });
+}
+
+json Volume::read_metadata(const std::string &json_filename) {
+	std::ifstream file(json_filename);
+	if (!file.is_open()) {
+		return {{"/", {{"type", "directory"}, {"contents", json::object()}}}};
+	}
+	json metadata;
+	try {
+		file >> metadata;
+	} catch (json::exception &) {
+		throw std::runtime_error("Failed to read file: " + json_filename);
+	}
+	return metadata;
+}
+
+void Volume::write_metadata(const std::string &json_filename, const json &metadata) {
+	// the new metadata goes to a file of its own and replaces the old file only once it is on disk,
+	// so a crash leaves one of the two whole
+	const std::string tmp_filename = json_filename + ".tmp";
+	const std::string text = metadata.dump(4); // pretty printed, so it can be read by hand
+	const int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd == -1) throw std::runtime_error("Failed to open file: " + tmp_filename + ": " + strerror(errno));
+	const auto fail = [&](const std::string & what) {
+		const std::string error = what + ": " + tmp_filename + ": " + strerror(errno);
+		::close(fd);
+		std::remove(tmp_filename.c_str());
+		throw std::runtime_error(error);
+	};
+	for (std::size_t written = 0; written < text.size();) {
+		const ssize_t count = ::write(fd, text.data() + written, text.size() - written);
+		if (count == -1) {
+			if (errno == EINTR) continue;
+			fail("Failed to write file");
+		}
+		written += count;
+	}
+	if (::fsync(fd) == -1) fail("Failed to sync file");
+	if (::close(fd) == -1) {
+		std::remove(tmp_filename.c_str());
+		throw std::runtime_error("Failed to close file: " + tmp_filename + ": " + strerror(errno));
+	}
+	if (std::rename(tmp_filename.c_str(), json_filename.c_str()) == -1) {
+		const std::string error = strerror(errno);
+		std::remove(tmp_filename.c_str());
+		throw std::runtime_error("Failed to replace file: " + json_filename + ": " + error);
+	}
+
+	// the rename itself is on disk once the directory holding the file is
+	const std::size_t slash = json_filename.rfind('/');
+	const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : json_filename.substr(0, slash);
+	const int directory_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+	if (directory_fd == -1) throw std::runtime_error("Failed to open directory: " + directory + ": " + strerror(errno));
+	const int synced = ::fsync(directory_fd);
+	const int error = errno;
+	::close(directory_fd);
+	if (synced == -1) throw std::runtime_error("Failed to sync directory: " + directory + ": " + strerror(error));
+}
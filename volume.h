@@ -0,0 +1,81 @@
+#ifndef VOLUME_H_
+#define VOLUME_H_
+#include <string>
+#include "json.hpp"
+#include "myfs.h"
+
+using json = nlohmann::json;
+
+/**
+ * Volume is one mounted filesystem: it owns the block device file, the metadata kept next to it
+ * in `<name>.json`, and the MyFs working on both.
+ *
+ * Volumes share no state, so any number of them can be mounted in one process, each used from
+ * its own threads (an AsyncMyFs per volume, for one).
+ */
+class Volume {
+public:
+	/**
+	 * When the metadata file is rewritten.
+	 */
+	enum class FlushPolicy {
+		EVERY_CHANGE, // after each operation that changes the metadata
+		ON_SYNC       // only by sync() and when the volume is unmounted
+	};
+
+	/**
+	 * @brief Mounts the volume, formatting the device and creating an empty metadata file if
+	 *        they don't exist yet.
+	 *
+	 * @param fname The block device file, the metadata is kept in fname + ".json".
+	 *
+	 * @throws std::runtime_error If the metadata file can't be read or created.
+	 */
+	explicit Volume(const std::string & fname, FlushPolicy policy = FlushPolicy::EVERY_CHANGE);
+
+	/**
+	 * @brief Unmounts the volume, saving the metadata first under FlushPolicy::ON_SYNC.
+	 */
+	~Volume();
+
+	Volume(const Volume &) = delete;
+	Volume & operator=(const Volume &) = delete;
+
+	MyFs & fs() {
+		return _fs;
+	}
+
+	const std::string & name() const {
+		return _fname;
+	}
+
+	/**
+	 * @brief Writes the metadata file now.
+	 *
+	 * @throws std::runtime_error If the metadata file can't be written.
+	 */
+	void sync();
+
+	static const std::string METADATA_SUFFIX;
+
+private:
+	/**
+	 * @return The metadata saved in the file, or an empty root directory if there is no file.
+	 */
+	static json read_metadata(const std::string & json_filename);
+
+	/**
+	 * @brief Replaces the metadata file atomically: the metadata is written and synced to
+	 *        json_filename + ".tmp", which is then renamed over the file and the directory synced.
+	 *
+	 * @throws std::runtime_error If any step fails, the old file is left as it was.
+	 */
+	static void write_metadata(const std::string & json_filename, const json & metadata);
+
+	const std::string _fname;
+	const FlushPolicy _policy;
+	json _data; // before _fs, which keeps a pointer to it
+	MyFs _fs;
+};
+
+#endif // VOLUME_H_